@@ -0,0 +1,122 @@
+#!/bin/sh
+#
+# arqbench.sh - how well the links recover from each kind of fault
+#
+# Runs one topology under every IMPAIR model (see impair.h), with the
+# reliable Go-Back-N links and with DATALINK=besteffort leaving recovery
+# to the transport, at each largest window topogen may give a link. One
+# line is printed a run:
+#
+#     model, arq, window    the fault, the recovery and topogen -w
+#     delivered             messages, from cnet's statistics
+#     goodput               delivered bytes a simulated second
+#     latency               mean delivery time in ms
+#     efficiency            application bytes over physical bytes, %
+#
+# Every run uses the same seed for cnet and for the faults, so a change
+# to the protocol can be compared model by model.
+#
+#     ./arqbench.sh [-e seconds] [-m "none burst ..."] [-w "2 4 ..."]
+#                   [-r seed] [TOPOLOGY]
+#
+# CNET is the simulator to run (cnet).
+
+seconds=600
+models="none burst reorder dup outage"
+windows="1 2 4 8 16"
+seed=1
+cnet=${CNET:-cnet}
+
+while [ $# -gt 1 ]
+do
+    case "$1" in
+        -e) seconds=$2 ;;
+        -m) models=$2 ;;
+        -w) windows=$2 ;;
+        -r) seed=$2 ;;
+        *)  break ;;
+    esac
+    shift 2
+done
+topology=${1:-ASSIGNMENT}
+if [ $# -gt 1 ] || [ ! -f "$topology" ]
+then
+    echo "usage: arqbench.sh [-e seconds] [-m models] [-w windows]" \
+        "[-r seed] [TOPOLOGY]" >&2
+    exit 1
+fi
+
+model()
+{
+    case "$1" in
+        none)    echo "" ;;
+        burst)   echo "loss=0.01 burst=8" ;;
+        reorder) echo "reorder=0.1 spread=200ms" ;;
+        dup)     echo "dup=0.05" ;;
+        outage)  echo "outage=60s:10s every=120s" ;;
+        *)       return 1 ;;
+    esac
+}
+
+make -s topogen || exit 1
+mkdir -p bench
+tmp=${TMPDIR:-/tmp}/arqbench.$$
+trap 'rm -f $tmp.*' EXIT
+base=$(basename $topology)
+
+printf "%-8s %-10s %6s %10s %10s %10s %10s\n" \
+    model arq window delivered goodput latency efficiency
+
+for w in $windows
+do
+    # the same topology, compiled against its own topology.h
+    name=$base-w$w
+    mkdir -p topo/$name
+    if ! ./topogen -w $w $topology > topo/$name/topology.h 2> $tmp.err
+    then
+        echo "topogen -w $w: $(head -1 $tmp.err)"
+        continue
+    fi
+    sed "s|-Itopo/[^ \"]*|-Itopo/$name|" $topology > bench/$name
+
+    for m in $models
+    do
+        if ! spec=$(model $m)
+        then
+            echo "$m: unknown model"
+            continue
+        fi
+        if [ "$m" != none ]
+        then
+            spec="$spec seed=$seed"
+        fi
+
+        for arq in gobackn besteffort
+        do
+            printf "%-8s %-10s %6s " $m $arq $w
+            if [ $arq = besteffort ]
+            then
+                datalink=besteffort
+            else
+                datalink=
+            fi
+
+            if ! IMPAIR="$spec" DATALINK=$datalink \
+                $cnet -W -q -S $seed -e ${seconds}s -s bench/$name > $tmp.out 2>&1
+            then
+                echo "cnet: $(tail -1 $tmp.out)"
+                continue
+            fi
+
+            awk -F: '
+                /Messages delivered/    { delivered = $2 + 0 }
+                /Message bandwidth/     { bandwidth = $2 + 0 }
+                /Average delivery time/ { latency = $2 + 0 }
+                /Efficiency/            { efficiency = $NF + 0 }
+                END {
+                    printf "%10d %10d %10.0f %10.1f\n", delivered,
+                        bandwidth / 8, latency / 1000, efficiency
+                }' $tmp.out
+        done
+    done
+done
@@ -1,59 +1,726 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <cnet.h>
 #include <stdlib.h>
 #include <string.h>
-typedef enum    { DL_DATA, DL_ACK }   Framekind;
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "traffic.h"
+#include "wire.h"
+#include "profile.h"
+#include "impair.h"
+
+/* NUM_NODES, MAX_LINKS, MAX_WINDOW, MAX_MESSAGE, MAX_FRAGMENT, MAX_PATHS,
+ * nextHops, linkWindow, linkPeer and pathCost for the topology being
+ * run, generated by topogen */
+#include "topology.h"
+
+/* a NAK acks like an ACK and also asks for everything after it again.
+ * a HELLO keeps an idle link alive and says where its sender is up to */
+typedef enum    { DL_DATA, DL_ACK, DL_NAK, DL_HELLO }   Framekind;
+
+/* traffic classes, control and routing always go first and the data
+ * classes share what is left by deficit round robin */
+typedef enum    { TC_CONTROL, TC_ROUTING, TC_INTERACTIVE, TC_BULK }   Frameclass;
+#define NUM_CLASSES 4
+
+/* messages we originate up to this size are interactive */
+#define INTERACTIVE_SIZE 64
+
+/* frames of each class that can wait on a link for room in the window.
+ * two windows, so each neighbour's share of the credit for it is still
+ * most of a window. the buffers for them come from the node's pool */
+#define QUEUE_LENGTH (2 * MAX_WINDOW)
+
+/* buffers on each link that only control frames can have, so acks
+ * still get out when data has taken the rest */
+#define POOL_CONTROL (QUEUE_LENGTH / 4)
+
+/* messages being put back together at once. enough for every node to
+ * be part way through a message on each of its links, so a fragment
+ * that would finish one is never held up by a full table */
+#define REASSEMBLY_SLOTS (NUM_NODES * MAX_LINKS)
+
+/* a message that gets no new fragment for this long is given up on */
+#define REASSEMBLY_TIMEOUT 300000000
+
+/* end to end messages and their acks. a NAK says a message went
+ * missing or was overtaken, as when a link fails or comes back. a
+ * multicast goes once to a set of destinations with no acks */
+typedef enum    { TP_DATA, TP_ACK, TP_NAK, TP_MCAST }   Segkind;
+
+/* bytes for a multicast's set of destinations, a bit per node */
+#define DEST_BYTES ((NUM_NODES + 7) / 8)
+
+/* transport connections to each destination, flows share them by number */
+#define TRANSPORT_FLOWS 8
+
+/* messages one connection can have unacked */
+#define TRANSPORT_WINDOW 16
+
+/* messages we can hold for all connections at once */
+#define TRANSPORT_SEGMENTS 64
+
+/* retransmission timeout before there is a round trip to go on,
+ * and how far it can move either way */
+#define TRANSPORT_RTO 30000000
+#define TRANSPORT_MIN_RTO 2000000
+#define TRANSPORT_MAX_RTO 600000000
+
+/* the least timeout when the links recover their own losses, the
+ * transport only goes back for what they have given up on */
+#define TRANSPORT_RELIABLE_RTO 120000000
 
-#define MAX_MESSAGE 256
-#define MAX_LINKS 4
-#define MAX_WINDOW 48
+/* how often unacked messages are checked for a timeout */
+#define TRANSPORT_TICK 500000
+
+/* timeouts in a row with nothing acked before a link is down */
+#define LINK_RETRIES 4
+
+/* keepalives a link can miss before it is down */
+#define LINK_MISSED 3
+
+/* the least time a link is left idle before a keepalive */
+#define KEEPALIVE_MIN 1000000
+
+/* how often links are checked for keepalives to send or miss */
+#define KEEPALIVE_TICK 500000
 
 typedef struct {
-    Framekind    kind;      	/* only ever DL_DATA or DL_ACK */
+    Framekind    kind;      	/* DL_DATA, DL_ACK, DL_NAK or DL_HELLO */
+    Frameclass   fclass;        /* set by whoever originated the message */
+    int          flow;          /* frames of one flow take the same path */
     size_t       len;       	/* the length of the msg field only */
-    int          checksum;  	/* checksum of the whole frame */
-    int          seq;       	/* only ever 0 or 1 */
-    int          packetIndex;
+    int          seq;       	/* from 0 to the link's window size */
+    int          credit;        /* ACKs: frames we can take after seq */
+    int          seen;          /* ACKs: frames had at a size, see sizeReport() */
+    int          corrupt;       /* ACKs: and how many of them were corrupt */
+    int          more;          /* data: the sender has more right behind */
     CnetAddr src_addr;
     CnetAddr dest_addr;
-    char     data[MAX_MESSAGE];
+    Segkind      segment;       /* end to end message or ack */
+    int          tseq;          /* end to end sequence number */
+    int          msgId;         /* which of the source's messages it is from */
+    int          epoch;         /* data: when the source booted, see bootEpoch */
+    size_t       offset;        /* where data goes in the whole message */
+    size_t       total;         /* the length of the whole message */
+    unsigned char dests[DEST_BYTES];    /* multicast destinations */
+    char     data[MAX_FRAGMENT];
 } Frame;
 
-#define FRAME_HEADER_SIZE  (sizeof(Frame) - (sizeof(char) * MAX_MESSAGE))
-#define FRAME_SIZE(f)      (FRAME_HEADER_SIZE + f.len)
+/*
+ * Frames go on the wire as
+ *
+ *     crc32    4   of everything after it
+ *     flags    1   kind, class and segment two bits each, then
+ *                  whether the frame is a fragment and whether more
+ *                  data follows it on the link
+ *     seq      2
+ *
+ * then ACKs, NAKs and HELLOs have their credit and the seen and corrupt
+ * of a size report as varints, and a HELLO of class TC_ROUTING a varint
+ * length and that many bytes of load for the network layer after it.
+ * data frames go on with
+ *
+ *     len      2
+ *     src, dest, flow, tseq + 1, msgId, epoch  varints
+ *     offset, total                        varints, fragments only
+ *     dests    a varint count of bytes, then the bit per node of a
+ *              multicast's destinations, multicasts only
+ *     data     len
+ */
+#define WIRE_FRAGMENT   0x01
+#define WIRE_MORE       0x02
+
+/* the most a header can take and the largest frame on the wire */
+#define WIRE_HEADER_MAX (4 + 1 + 2 + 2 + 9 * WIRE_VARMAX + DEST_BYTES)
+#define WIRE_FRAME_MAX  (WIRE_HEADER_MAX + MAX_FRAGMENT)
+
+#if MAX_WINDOW > 0xffff || MAX_FRAGMENT > 0xffff
+#error "sequence numbers and frame lengths only have 16 bits on the wire"
+#endif
+
+/* does a data frame carry part of a larger message */
+static int isFragment(const Frame *f)
+{
+    return f->offset != 0 || f->len != f->total;
+}
+
+/* is a node one of a multicast frame's destinations */
+static int destHas(const Frame *f, CnetAddr addr)
+{
+    return (f->dests[addr / 8] >> (addr % 8)) & 1;
+}
+
+static void destAdd(Frame *f, CnetAddr addr)
+{
+    f->dests[addr / 8] |= 1 << (addr % 8);
+}
+
+/* bytes of the destination set up to the last node in it */
+static size_t destLength(const Frame *f)
+{
+    size_t n = DEST_BYTES;
+
+    while (n > 0 && f->dests[n - 1] == 0)
+    {
+        n--;
+    }
+    return n;
+}
+
+/* bytes a frame takes on the wire */
+static size_t wireLength(const Frame *f)
+{
+    size_t n = 4 + 1 + 2;
+
+    if (f->kind != DL_DATA)
+    {
+        n += wire_varlen(f->credit) + wire_varlen(f->seen) +
+            wire_varlen(f->corrupt);
+        if (f->kind == DL_HELLO && f->fclass == TC_ROUTING)
+        {
+            n += wire_varlen(f->len) + f->len;
+        }
+        return n;
+    }
+
+    n += 2 + f->len;
+    n += wire_varlen(f->src_addr) + wire_varlen(f->dest_addr) +
+        wire_varlen(f->flow) + wire_varlen(f->tseq + 1) + wire_varlen(f->msgId) +
+        wire_varlen(f->epoch);
+    if (isFragment(f))
+    {
+        n += wire_varlen(f->offset) + wire_varlen(f->total);
+    }
+    if (f->segment == TP_MCAST)
+    {
+        n += wire_varlen(destLength(f)) + destLength(f);
+    }
+    return n;
+}
+
+#define FRAME_SIZE(f)      wireLength(&(f))
+
+/* write f out for the wire, returns its length */
+static size_t frame_encode(const Frame *f, unsigned char *buf)
+{
+    PROF_FUNC();
+    Wire w;
+    Wire crc;
+
+    wire_init(&w, buf, WIRE_FRAME_MAX);
+    wire_put32(&w, 0);
+    wire_put8(&w, (f->kind & 3) << 6 | (f->fclass & 3) << 4 |
+            (f->kind == DL_DATA ? (f->segment & 3) << 2 : 0) |
+            (f->kind == DL_DATA && isFragment(f) ? WIRE_FRAGMENT : 0) |
+            (f->kind == DL_DATA && f->more ? WIRE_MORE : 0));
+    wire_put16(&w, f->seq);
+
+    if (f->kind != DL_DATA)
+    {
+        wire_putvar(&w, f->credit);
+        wire_putvar(&w, f->seen);
+        wire_putvar(&w, f->corrupt);
+        if (f->kind == DL_HELLO && f->fclass == TC_ROUTING)
+        {
+            wire_putvar(&w, f->len);
+            wire_putbytes(&w, f->data, f->len);
+        }
+    }
+    else
+    {
+        wire_put16(&w, f->len);
+        wire_putvar(&w, f->src_addr);
+        wire_putvar(&w, f->dest_addr);
+        wire_putvar(&w, f->flow);
+        wire_putvar(&w, f->tseq + 1);
+        wire_putvar(&w, f->msgId);
+        wire_putvar(&w, f->epoch);
+        if (isFragment(f))
+        {
+            wire_putvar(&w, f->offset);
+            wire_putvar(&w, f->total);
+        }
+        if (f->segment == TP_MCAST)
+        {
+            wire_putvar(&w, destLength(f));
+            wire_putbytes(&w, f->dests, destLength(f));
+        }
+        wire_putbytes(&w, f->data, f->len);
+    }
+
+    wire_init(&crc, buf, 4);
+    wire_put32(&crc, CNET_crc32(buf + 4, w.pos - 4));
+    return w.pos;
+}
+
+/* read a frame off the wire, 0 if it is damaged */
+static int frame_decode(unsigned char *buf, size_t len, Frame *f)
+{
+    PROF_FUNC();
+    Wire w;
+    uint32_t crc;
+    uint32_t flags;
+    uint32_t ndests;
+
+    wire_init(&w, buf, len);
+    crc = wire_get32(&w);
+    if (w.bad || CNET_crc32(buf + 4, len - 4) != crc)
+    {
+        return 0;
+    }
+
+    memset(f, 0, sizeof(Frame) - MAX_FRAGMENT);
+    flags = wire_get8(&w);
+    f->kind = flags >> 6;
+    f->fclass = (flags >> 4) & 3;
+    f->segment = (flags >> 2) & 3;
+    f->seq = wire_get16(&w);
+
+    if (f->kind != DL_DATA)
+    {
+        f->credit = wire_getvar(&w);
+        f->seen = wire_getvar(&w);
+        f->corrupt = wire_getvar(&w);
+        if (f->kind == DL_HELLO && f->fclass == TC_ROUTING)
+        {
+            f->len = wire_getvar(&w);
+            if (f->len > MAX_FRAGMENT)
+            {
+                return 0;
+            }
+            wire_getbytes(&w, f->data, f->len);
+        }
+        return !w.bad && w.pos == len;
+    }
+
+    f->len = wire_get16(&w);
+    f->src_addr = wire_getvar(&w);
+    f->dest_addr = wire_getvar(&w);
+    f->flow = wire_getvar(&w);
+    f->tseq = (int)wire_getvar(&w) - 1;
+    f->msgId = wire_getvar(&w);
+    f->epoch = wire_getvar(&w);
+    f->more = (flags & WIRE_MORE) != 0;
+    f->total = f->len;
+    if (flags & WIRE_FRAGMENT)
+    {
+        f->offset = wire_getvar(&w);
+        f->total = wire_getvar(&w);
+    }
+    if (f->segment == TP_MCAST)
+    {
+        ndests = wire_getvar(&w);
+        if (ndests > DEST_BYTES)
+        {
+            return 0;
+        }
+        wire_getbytes(&w, f->dests, ndests);
+    }
+    if (w.bad || f->len > MAX_FRAGMENT || w.pos + f->len != len ||
+        f->src_addr >= NUM_NODES || f->dest_addr >= NUM_NODES)
+    {
+        return 0;
+    }
+    wire_getbytes(&w, f->data, f->len);
+    return 1;
+}
 
 
 static void datalink_down(Frame f, Framekind kind, 
                     int seqno, int link);
+static void datalink_send(int link);
+static void transmitFrame(int link, Frame f);
+static void physical_flush(int link);
+static int queuedData(int link);
+static void application_resume(int link);
+static void application_update(void);
+static void network_send(int link);
+static void transport_ready(CnetAddr src, int epoch, int flow, Segkind segment,
+                    int tseq, char *data, size_t len);
+static void transport_send(void);
+static void routing_ready(int link, Frame f);
+static CnetTime txTime(int link, size_t len);
 
-static int packetIndex = 0;
-Frame lastFrame[MAX_LINKS];
 static CnetTimerID timer[MAX_LINKS];
 
-// how large are our buffers?
-static int windowSize;
+/* startTimer() has one EV_TIMER per link */
+#if MAX_LINKS > 4
+#error "topology has nodes with more than four links"
+#endif
+
+#ifndef ACK_EVERY
+#error "topology.h is from an older topogen, run make"
+#endif
+
+// how large are our buffers? both ends of a link agree on this
+static int windowSize[MAX_LINKS];
 
 // how much of each links buffer had been used?
 static int windowUsed[MAX_LINKS];
 
-// holds all our windows
-static Frame window[MAX_LINKS][MAX_WINDOW];
+// holds all our windows, the frames themselves are in the pool
+static Frame *window[MAX_LINKS][MAX_WINDOW];
+
+/* frames waiting for room in a links window, one ring per class */
+typedef struct {
+    Frame   *frames[QUEUE_LENGTH];
+    int     head;
+    int     used;
+} FrameQueue;
+
+/*
+ * buffers for every frame in a window or queue, shared by all of the
+ * node's links and sized from the links it actually has. each link is
+ * sure of its reserve and can borrow what the others aren't using up
+ * to its cap.
+ */
+static Frame *pool;
+static Frame **poolFree;
+static int poolSize;
+static int poolFreeCount;
+static int poolUsed[MAX_LINKS];
+static int poolReserve[MAX_LINKS];
+static int poolCap[MAX_LINKS];
+
+/* the most buffers each link, and the whole node, have held at once */
+static int poolPeak[MAX_LINKS];
+static int poolPeakAll;
+
+static FrameQueue queue[MAX_LINKS][NUM_CLASSES];
+
+/* deficit round robin between the data classes of each link */
+static int deficit[MAX_LINKS][NUM_CLASSES];
+static int drrClass[MAX_LINKS];
+static int drrFresh[MAX_LINKS];
+
+/* frames each flow has queued on a link and the class they are in. a
+ * flow only ever waits in one class so the scheduler can't reorder it,
+ * flows that share a bucket just share a class for a while */
+#define FLOW_BUCKETS 64
+#define FLOW(f) ((unsigned)((f).src_addr * 31 + (f).dest_addr) % FLOW_BUCKETS)
 
-//static int ackexpected[MAX_LINKS];
-static int nextframetosend[MAX_LINKS];
-//static int frameexpected[MAX_LINKS];
+static int flowQueued[MAX_LINKS][FLOW_BUCKETS];
+static Frameclass flowClass[MAX_LINKS][FLOW_BUCKETS];
+
+/* frames of our own messages in each queue. they only get their share
+ * of it, the rest is what we can promise the neighbours relaying
+ * through us */
+static int ownQueued[MAX_LINKS][NUM_CLASSES];
+
+/* bytes a data class may send per round, interactive gets three
+ * times the share of bulk */
+static const int quantum[NUM_CLASSES] = {
+    0, 0, 3 * WIRE_FRAME_MAX, WIRE_FRAME_MAX
+};
 
 static int expectedFrame[MAX_LINKS];
 static int nextToReceive[MAX_LINKS];
 
-const int routingTable[7][7] = {
-    {0, 1, 2, 3, 4, 4, 4}, /* Indonesia */
-    {1, 0, 2, 1, 1, 1, 1}, /* Malaysia */
-    {1, 2, 0, 1, 1, 1, 1}, /* Singapore */
-    {1, 1, 1, 0, 1, 1, 1}, /* Brunei */
-    {1, 1, 1, 1, 0, 2, 3}, /* Australia */
-    {1, 1, 1, 1, 1, 0, 1}, /* Fiji */
-    {1, 1, 1, 1, 1, 1, 0}, /* New Zealand */
-};
+/* we have NAKed the gap on a link and are waiting for it to fill */
+static int nakSent[MAX_LINKS];
+
+/* frames taken in order since the last ACK or NAK on each link, and the
+ * EV_TIMER10 that ACKs them if no more arrive. every ACK is cumulative,
+ * so one covers them all. ACK_EVERY comes from topology.h, topogen gives
+ * each window room for that many */
+static int ackPending[MAX_LINKS];
+static CnetTimerID ackTimer[MAX_LINKS];
+
+/* frames the other end of each link will take after the last ACK,
+ * and what we last told it we would take */
+static int txCredit[MAX_LINKS];
+static int rxAdvertised[MAX_LINKS];
+
+/* when each link last went back over its window, 0 if never, and
+ * the frame it went back to */
+static CnetTime resentAt[MAX_LINKS];
+static int resentSeq[MAX_LINKS];
+
+/* links we have given up on until something is heard from them, the
+ * timeouts in a row each has had, and when each last heard and sent
+ * anything */
+static int linkDown[MAX_LINKS];
+static int linkRetries[MAX_LINKS];
+static CnetTime lastHeard[MAX_LINKS];
+static CnetTime lastSent[MAX_LINKS];
+
+/* frames and bytes sent on each link, for utilisation */
+static long linkFrames[MAX_LINKS];
+static long linkBytes[MAX_LINKS];
+
+/*
+ * the size of data frame each link sends, chosen from levels of 64
+ * bytes doubling up to the most it can carry. the receiver counts the
+ * frames arriving at each level and how many are corrupt, and reports
+ * its totals back in its ACKs for the sender to choose by. the sender
+ * halves its counts every SIZE_SAMPLES frames so old ones fade.
+ */
+#define SIZE_MIN        64
+#define SIZE_LEVELS     5
+#define SIZE_SAMPLES    256
+#define SIZE_MEASURED   64      /* frames before a level's rate is used */
+#define SIZE_CHOOSE     16      /* frames between choosing again */
+#define SIZE_OVERHEAD   24      /* a data frame's header and its ACK */
+#define SIZE_WRAP       1024    /* reported totals go round at this */
+
+static long sizeFrames[MAX_LINKS][SIZE_LEVELS];
+static long sizeBad[MAX_LINKS][SIZE_LEVELS];
+static int sizeLevel[MAX_LINKS];
+static int sizeCount[MAX_LINKS];
+
+/* frames received at each level and how many were corrupt, the level
+ * the next ACK reports, and the last totals heard from the other end,
+ * -1 for none */
+static long sizeSeen[MAX_LINKS][SIZE_LEVELS];
+static long sizeCorrupt[MAX_LINKS][SIZE_LEVELS];
+static int sizeNext[MAX_LINKS];
+static long sizeHeardSeen[MAX_LINKS][SIZE_LEVELS];
+static long sizeHeardCorrupt[MAX_LINKS][SIZE_LEVELS];
+
+/* corrupt frames received and frames sent again on each link */
+static long linkCorrupt[MAX_LINKS];
+static long linkResent[MAX_LINKS];
+
+/* when each frame in a window went in, and the smoothed time from
+ * there to its ACK on each link, 0 until there is a sample */
+static CnetTime linkSentAt[MAX_LINKS][MAX_WINDOW + 1];
+static CnetTime linkSrtt[MAX_LINKS];
+
+/* frames written out for the wire, waiting for the line to be free.
+ * each link has one queue for ACKs, NAKs and HELLOs and one for data,
+ * the first always goes first. a reliable link never has more than
+ * its window waiting, a best effort one only takes the next frame
+ * once the line has room. both hold a window's worth, allocated for
+ * the links the node has when it reboots */
+typedef struct {
+    size_t          len;
+    unsigned char   wire[WIRE_FRAME_MAX];
+} TxFrame;
+
+typedef struct {
+    TxFrame *frames;
+    int     length;
+    int     head;
+    int     used;
+} TxQueue;
+
+enum { TX_CONTROL, TX_DATA, TX_QUEUES };
+
+static TxQueue txQueue[MAX_LINKS][TX_QUEUES];
+static TxFrame *txFrames;
+
+/* when the frame on each line has finished going out, and whether
+ * EV_TIMER9 is already waiting for it */
+static CnetTime busyUntil[MAX_LINKS];
+static int txWaiting[MAX_LINKS];
+
+/* how long to wait if cnet still finds the line busy when we thought
+ * it was free */
+#define TX_RETRY 1000
+
+/* frames IMPAIR is holding back to deliver late, each with its own
+ * EV_TIMER10. one that finds them all taken is delivered on time */
+#define HELD_FRAMES 32
+
+typedef struct {
+    CnetTime        until;
+    int             link;
+    size_t          len;
+    unsigned char   wire[WIRE_FRAME_MAX];
+} HeldFrame;
+
+static HeldFrame held[HELD_FRAMES];
+static int heldCount;
+
+/* where our messages come from and the next one due, see traffic.h */
+static TrafficMode trafficMode;
+static TrafficRecord nextRecord;
+
+/* DATALINK=besteffort, links send frames once and never ack them,
+ * the transport layer recovers anything lost */
+static int bestEffort;
+
+/* the message being cut into fragments for each link. the application
+ * waits for a link until its message has all been queued */
+typedef struct {
+    int     busy;
+    int     sending;    /* network_send() is already filling the queue */
+    Frame   header;     /* addresses, class, flow and id for every fragment */
+    size_t  offset;     /* how much has been queued so far */
+    char    data[MAX_MESSAGE];
+} Outgoing;
+
+static Outgoing outgoing[MAX_LINKS];
+static int messageId = 0;
+
+/* a message on its way down, too big for the stack */
+static char message[MAX_MESSAGE];
+
+/* messages we are the destination of that have only partly arrived */
+typedef struct {
+    int         used;
+    CnetAddr    src;
+    int         flow;
+    Segkind     segment;
+    int         tseq;
+    int         msgId;
+    int         epoch;
+    size_t      received;
+    size_t      total;
+    CnetTime    updated;
+    char        data[MAX_MESSAGE];
+} Reassembly;
+
+static Reassembly reassembly[REASSEMBLY_SLOTS];
+static int reassemblyTimer = 0;
+
+/* a message we originated, kept until its destination acks it */
+typedef struct {
+    int         used;
+    int         queued;     /* handed to the network layer */
+    int         resent;     /* sent more than once, so no RTT sample */
+    CnetAddr    dest;
+    int         flow;
+    int         tseq;
+    CnetTime    sentAt;
+    size_t      len;
+    char        data[MAX_MESSAGE];
+} Segment;
+
+static Segment segments[TRANSPORT_SEGMENTS];
+static int transportSending = 0;
+static int transportTimer = 0;
+
+/* our end of the connection to a destination on a flow */
+typedef struct {
+    int         nextSeq;    /* for the next message we send */
+    int         unacked;
+    CnetTime    srtt;
+    CnetTime    rttvar;
+    CnetTime    rto;
+} Connection;
+
+static Connection connection[NUM_NODES][TRANSPORT_FLOWS];
+
+/* the sequence number we want next from each source on each flow,
+ * and whether we have NAKed the gap in front of it */
+static int tpExpected[NUM_NODES][TRANSPORT_FLOWS];
+static int tpNakSent[NUM_NODES][TRANSPORT_FLOWS];
+
+/* the second this node booted, 0 for the first boot, on every message
+ * we send. a node that reboots without its checkpoint numbers its
+ * connections from 0 again and has forgotten everyone else's, so its
+ * peers start theirs again when they see a later boot. tpEpoch is the
+ * latest boot we have heard from each node */
+static int bootEpoch;
+static int tpEpoch[NUM_NODES];
+
+/* multicasts are numbered by their source. the last few numbers we
+ * had from each source, plus one, so a copy rerouted when a link
+ * failed isn't delivered twice */
+#define MCAST_RECENT 32
+static int mcastNextSeq;
+static int mcastSeen[NUM_NODES][MCAST_RECENT];
+static int mcastSeenNext[NUM_NODES];
+
+/*
+ * what a node needs to carry on after a reboot, kept in a memory
+ * mapped file when CHECKPOINT names a directory for them. frames are
+ * written as they go into a window, by sequence number, and the
+ * transport's messages and connections as they change. the per link
+ * numbers are copied at the end of each event.
+ */
+#define CHECKPOINT_MAGIC 0x636b7074
+
+typedef struct {
+    uint32_t    magic;
+    uint32_t    size;       /* of the whole checkpoint, so a file from a
+                             * different build isn't used */
+    int         node;
+    int         windowSize[MAX_LINKS];
+    int         windowUsed[MAX_LINKS];
+    int         expectedFrame[MAX_LINKS];
+    int         nextToReceive[MAX_LINKS];
+    int         txCredit[MAX_LINKS];
+    int         messageId;
+    int         mcastNextSeq;
+    int         bootEpoch;
+    Segment     segments[TRANSPORT_SEGMENTS];
+    Connection  connection[NUM_NODES][TRANSPORT_FLOWS];
+    int         tpExpected[NUM_NODES][TRANSPORT_FLOWS];
+    int         tpEpoch[NUM_NODES];
+    int         mcastSeen[NUM_NODES][MCAST_RECENT];
+    int         mcastSeenNext[NUM_NODES];
+    Frame       window[MAX_LINKS][MAX_WINDOW + 1];
+} Checkpoint;
+
+static Checkpoint *checkpoint;
+
+/* copy the per link numbers into the checkpoint, at the end of each
+ * event so they are never caught half changed */
+static void checkpoint_save(int *event)
+{
+    (void)event;
+    if (checkpoint == NULL)
+    {
+        return;
+    }
+    memcpy(checkpoint->windowUsed, windowUsed, sizeof(windowUsed));
+    memcpy(checkpoint->expectedFrame, expectedFrame, sizeof(expectedFrame));
+    memcpy(checkpoint->nextToReceive, nextToReceive, sizeof(nextToReceive));
+    memcpy(checkpoint->txCredit, txCredit, sizeof(txCredit));
+    checkpoint->messageId = messageId;
+    checkpoint->mcastNextSeq = mcastNextSeq;
+}
+
+/* a message was taken on or let go. its data is only copied once, when
+ * it is taken on */
+static void checkpoint_segment(Segment *s)
+{
+    if (checkpoint == NULL)
+    {
+        return;
+    }
+    if (s->used)
+    {
+        checkpoint->segments[s - segments] = *s;
+    }
+    else
+    {
+        checkpoint->segments[s - segments].used = 0;
+    }
+}
+
+/* the transport's state for one destination and flow changed */
+static void checkpoint_connection(CnetAddr dest, int flow)
+{
+    if (checkpoint == NULL)
+    {
+        return;
+    }
+    checkpoint->connection[dest][flow] = connection[dest][flow];
+    checkpoint->tpExpected[dest][flow] = tpExpected[dest][flow];
+    checkpoint->tpEpoch[dest] = tpEpoch[dest];
+}
+
+/* a multicast from src has been seen */
+static void checkpoint_mcast(CnetAddr src)
+{
+    if (checkpoint == NULL)
+    {
+        return;
+    }
+    memcpy(checkpoint->mcastSeen[src], mcastSeen[src], sizeof(mcastSeen[src]));
+    checkpoint->mcastSeenNext[src] = mcastSeenNext[src];
+}
+
+/* saves the checkpoint whichever way the event handler it starts
+ * returns */
+#define CHECKPOINT_EVENT() \
+    int checkpoint_event_ __attribute__((cleanup(checkpoint_save))) = 0
 
 void printFrame(int link, Frame *f, size_t length)
 {
@@ -73,10 +740,18 @@ void printFrame(int link, Frame *f, size_t length)
         {
             printf("DATA\n");
         }
-        else
+        else if (f->kind == DL_ACK)
         {
             printf("ACK\n");
         }
+        else if (f->kind == DL_HELLO)
+        {
+            printf("HELLO\n");
+        }
+        else
+        {
+            printf("NAK\n");
+        }
     }
 }
 
@@ -102,11 +777,12 @@ int expectedNextFrame(int link)
 */
 
 /* find the next sequency number that we should
- * use */
+ * use. they run from 0 to windowSize so a whole window
+ * of retransmissions can't be taken for new frames */
 int expectedNextFrame(int link)
 {
     int nextFrame = expectedFrame[link - 1];
-    if (nextFrame + 1 > (windowSize - 1))
+    if (nextFrame + 1 > windowSize[link - 1])
     {
         nextFrame = 0;
     }
@@ -118,11 +794,23 @@ int expectedNextFrame(int link)
     return nextFrame;
 }
 
+/* the sequence number of the newest frame the other end has acked,
+ * the one before the oldest in the window */
+static int lastAcked(int link)
+{
+    if (windowUsed[link - 1] == 0)
+    {
+        return expectedFrame[link - 1];
+    }
+    return (window[link - 1][0]->seq + windowSize[link - 1]) %
+        (windowSize[link - 1] + 1);
+}
+
 /* find the next sequency number we should expect */
 int nextReceive(int link)
 {
     int nextFrame = nextToReceive[link - 1];
-    if (nextFrame + 1 > (windowSize - 1))
+    if (nextFrame + 1 > windowSize[link - 1])
     {
         nextFrame = 0;
     }
@@ -158,384 +846,3250 @@ void startTimer(int link, CnetTime timeout)
         case 1:
             timer[1] = CNET_start_timer(EV_TIMER2, 3 * timeout, 0);
             break;
+#if MAX_LINKS > 2
         case 2:
             timer[2] = CNET_start_timer(EV_TIMER3, 3 * timeout, 0);
             break;
+#endif
+#if MAX_LINKS > 3
         case 3:
             timer[3] = CNET_start_timer(EV_TIMER4, 3 * timeout, 0);
             break;
+#endif
     }
 }
 
 void restartTimer(int link, CnetTime timeout)
 {
-    switch((link - 1))
+    CNET_stop_timer(timer[link - 1]);
+    timer[link - 1] = NULLTIMER;
+
+    /* nothing left to time out */
+    if (windowUsed[link - 1] > 0)
     {
-        case 0:
-            CNET_stop_timer(timer[0]);
-            break;
-        case 1:
-            CNET_stop_timer(timer[1]);
-            break;
-        case 2:
-            CNET_stop_timer(timer[2]);
-            break;
-        case 3:
-            CNET_stop_timer(timer[3]);
-            break;
+        startTimer(link, timeout);
+    }
+    /* out of credit with frames waiting, in case the update
+     * that opens the link again is lost */
+    else if (txCredit[link - 1] == 0 && queuedData(link))
+    {
+        startTimer(link, WIRE_FRAME_MAX *
+                ((CnetTime)8000000 / linkinfo[link].bandwidth) +
+                linkinfo[link].propagationdelay);
     }
+}
 
-    startTimer(link, timeout);
+/* how long a frame takes to get across the link */
+static CnetTime frameTime(int link, Frame f)
+{
+    return FRAME_SIZE(f)*((CnetTime)8000000 / linkinfo[link].bandwidth) +
+        linkinfo[link].propagationdelay;
 }
 
-/**
- * Network and application layer for receiver
+/* how long until everything in the window has gone out and been acked */
+static CnetTime roundTrip(int link)
+{
+    return windowUsed[link - 1] * FRAME_SIZE(*window[link - 1][0]) *
+        ((CnetTime)8000000 / linkinfo[link].bandwidth) +
+        2 * linkinfo[link].propagationdelay;
+}
+
+/* spread src, dest and flow over 32 bits, salted with our node
+ * number so each hop splits flows independently */
+static unsigned int flowHash(CnetAddr src, CnetAddr dest, int flow)
+{
+    unsigned int h = nodeinfo.nodenumber * 2654435761u;
+
+    h ^= src * 0x85ebca6bu;
+    h ^= dest * 0xc2b2ae35u;
+    h ^= flow * 0x27d4eb2fu;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    return h;
+}
+
+/*
+ * weight the next hops by bandwidth and pick the one hash lands on,
+ * leaving out links that are down if skipDown is set. 0 if none.
  */
-static void network_ready(Frame f, size_t length, int link)
+static int pickHop(const NextHop *hops, unsigned int hash, int skipDown)
 {
-    /* check if this is out node, or if we need to route it */
-    if (nodeinfo.nodenumber != f.dest_addr)
-    {
-        printf("NETWORK: We got a node for %d seq %d, we are %d\n         It came from link #%d\n",
-                f.dest_addr, f.seq, nodeinfo.nodenumber, link);
-        int newLink = routingTable[nodeinfo.nodenumber][f.dest_addr];
+    unsigned long total = 0;
+    unsigned long point;
+    int ii;
 
-        /* pass a new datalink_down through */
-        datalink_down(f, DL_DATA, expectedNextFrame(newLink), newLink);
+    for (ii = 0; ii < MAX_PATHS && hops[ii].link != 0; ii++)
+    {
+        if (!skipDown || !linkDown[hops[ii].link - 1])
+        {
+            total += linkinfo[hops[ii].link].bandwidth;
+        }
     }
-    else
+    if (total == 0)
     {
-        /* this is our frame. */
-        printf("this is our frame\n");
-        printf("frame of size %d about to be written to application\n", length);
-
-        CHECK(CNET_write_application((char *)&f.data, &f.len));
+        return 0;
     }
 
+    point = hash % total;
+    for (ii = 0; ii < MAX_PATHS && hops[ii].link != 0; ii++)
+    {
+        if (skipDown && linkDown[hops[ii].link - 1])
+        {
+            continue;
+        }
+        if (point < (unsigned long)linkinfo[hops[ii].link].bandwidth)
+        {
+            break;
+        }
+        point -= linkinfo[hops[ii].link].bandwidth;
+    }
+    return hops[ii].link;
 }
 
-/**
- * Data link layer for receiver
+/*
+ * a neighbour that can take frames for dest while all our next hops
+ * are down. only one whose own path to dest doesn't come back through
+ * us, so nothing loops. 0 if there isn't one.
  */
-static void datalink_ready(int link, Frame f)
+static int alternateLink(CnetAddr dest)
 {
-    int checksum = f.checksum;
+    int me = nodeinfo.nodenumber;
+    int best = 0;
+    long bestCost = 0;
+    int link;
 
-    /* remove the checksum from the packet and recompute it */
-    f.checksum = 0;
-    if(CNET_ccitt((unsigned char *)&f, (int)sizeof(Frame)) != checksum) {
-        printf("\t\t\t\tBAD checksum - frame ignored\n");
-        return;            /*bad checksum, ignore frame*/
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        int peer = linkPeer[me][link - 1];
+        long cost = pathCost[me][peer] + pathCost[peer][dest];
+
+        if (linkDown[link - 1] ||
+            pathCost[peer][dest] >= pathCost[peer][me] + pathCost[me][dest])
+        {
+            continue;
+        }
+        if (best == 0 || cost < bestCost)
+        {
+            best = link;
+            bestCost = cost;
+        }
     }
+    return best;
+}
 
-    int ii;
-    int accepted = 0;
+/*
+ * the next hops we use towards each destination. they start as
+ * topogen's and move with the load on our links and our neighbours',
+ * see routeUpdate(). a link joins a destination's routes when its
+ * cost is within ROUTE_ENTER percent of the best and leaves when it
+ * is past ROUTE_LEAVE, so routes don't swing back and forth.
+ */
+#define ROUTE_ENTER     110
+#define ROUTE_LEAVE     130
+#define ROUTE_TICK      1000000     /* between looking at our load */
+#define ROUTE_REFRESH   10000000    /* between telling neighbours anyway */
+#define ROUTE_CHANGE    100000      /* a change in delay worth telling */
 
-    /* check what type of frame we have received */
-    switch (f.kind) {
+static NextHop routes[NUM_NODES][MAX_PATHS];
 
-        /* we got an ACK check what frame we are on */
-        case DL_ACK:
+/* the delay on each of its links a neighbour last told us of, what
+ * we last told ours, when, and how many times since it changed */
+static CnetTime peerDelay[MAX_LINKS][MAX_LINKS];
+static CnetTime toldDelay[MAX_LINKS];
+static CnetTime routeTold;
+static int routeRepeats = 2;
+static CnetTime routeChecked;
+
+/*
+ * which of our next hops towards dest a flow uses. every frame of
+ * a flow hashes to the same link so it stays in order, and flows
+ * land on each link in proportion to its bandwidth. a flow whose
+ * link is down moves to one of the others, or to a loop free
+ * alternate if they are all down. 0 if dest is us or unreachable.
+ */
+static int routeLink(CnetAddr src, CnetAddr dest, int flow)
+{
+    PROF_FUNC();
+    const NextHop *hops = routes[dest];
+    unsigned int hash = flowHash(src, dest, flow);
+    int link = pickHop(hops, hash, 0);
+
+    if (link == 0 || !linkDown[link - 1])
+    {
+        return link;
+    }
+    link = pickHop(hops, hash, 1);
+    return link != 0 ? link : alternateLink(dest);
+}
+
+/* pick a class for a message we originate */
+static Frameclass classify(size_t len)
+{
+    return len <= INTERACTIVE_SIZE ? TC_INTERACTIVE : TC_BULK;
+}
+
+/* buffers a link has been promised and isn't using yet */
+static int poolHeadroom(int link)
+{
+    int spare = poolReserve[link - 1] - poolUsed[link - 1];
+
+    return spare > 0 ? spare : 0;
+}
+
+/* how many more buffers a link can have, its own reserve and
+ * whatever isn't promised to the other links, up to its cap */
+static int poolRoom(int link)
+{
+    int shared = poolFreeCount;
+    int room;
+    int other;
+
+    for (other = 1; other <= nodeinfo.nlinks; other++)
+    {
+        shared -= poolHeadroom(other);
+    }
+    room = poolHeadroom(link) + (shared > 0 ? shared : 0);
+    if (room > poolCap[link - 1] - poolUsed[link - 1])
+    {
+        room = poolCap[link - 1] - poolUsed[link - 1];
+    }
+    return room > 0 ? room : 0;
+}
+
+/* take a buffer for a frame on the link, check poolRoom() first */
+static Frame *poolGet(int link)
+{
+    Frame *b = poolFree[--poolFreeCount];
+
+    poolUsed[link - 1]++;
+    if (poolUsed[link - 1] > poolPeak[link - 1])
+    {
+        poolPeak[link - 1] = poolUsed[link - 1];
+    }
+    if (poolSize - poolFreeCount > poolPeakAll)
+    {
+        poolPeakAll = poolSize - poolFreeCount;
+    }
+    return b;
+}
+
+static void poolPut(int link, Frame *b)
+{
+    poolFree[poolFreeCount++] = b;
+    poolUsed[link - 1]--;
+}
+
+/*
+ * a window and a queue's worth of buffers for each of our links, and
+ * a few for control frames. a link is sure of its window and half a
+ * queue, and can borrow up to two queues' worth on top of its window.
+ */
+static void poolInit(void)
+{
+    int link;
+    int ii;
+
+    poolSize = 0;
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        poolReserve[link - 1] = windowSize[link - 1] + QUEUE_LENGTH / 2 + POOL_CONTROL;
+        poolCap[link - 1] = windowSize[link - 1] + 2 * QUEUE_LENGTH + POOL_CONTROL;
+        poolSize += windowSize[link - 1] + QUEUE_LENGTH + POOL_CONTROL;
+    }
+
+    /* a reboot starts with an empty pool */
+    free(pool);
+    free(poolFree);
+    pool = calloc(poolSize, sizeof(Frame));
+    poolFree = calloc(poolSize, sizeof(Frame *));
+    for (ii = 0; ii < poolSize; ii++)
+    {
+        poolFree[ii] = &pool[ii];
+    }
+    poolFreeCount = poolSize;
+}
+
+/* buffers a frame of this class can have on the link */
+static int classRoom(int link, Frameclass fclass)
+{
+    int room = poolRoom(link) - (fclass == TC_CONTROL ? 0 : POOL_CONTROL);
+
+    return room > 0 ? room : 0;
+}
+
+/* is there space for one more frame of this class on the link */
+static int queueRoom(int link, Frameclass fclass)
+{
+    return queue[link - 1][fclass].used < QUEUE_LENGTH && classRoom(link, fclass) > 0;
+}
+
+/* how many more frames of this class the link can queue */
+static int queueSpace(int link, Frameclass fclass)
+{
+    int space = QUEUE_LENGTH - queue[link - 1][fclass].used;
+    int room = classRoom(link, fclass);
+
+    return room < space ? room : space;
+}
+
+/* how much of each queue our own messages can have, the rest is
+ * split between the other links */
+static int ownShare(void)
+{
+    return nodeinfo.nlinks > 1 ? QUEUE_LENGTH / nodeinfo.nlinks : QUEUE_LENGTH;
+}
+
+/* can we queue one more frame of our own */
+static int ownRoom(int link, Frameclass fclass)
+{
+    return queueRoom(link, fclass) && ownQueued[link - 1][fclass] < ownShare();
+}
+
+/* the largest piece of a message that fits in one frame on the link */
+static size_t fragmentLimit(int link)
+{
+    size_t size = MAX_FRAGMENT;
+
+    if (linkinfo[link].mtu > WIRE_HEADER_MAX &&
+        (size_t)linkinfo[link].mtu - WIRE_HEADER_MAX < size)
+    {
+        size = linkinfo[link].mtu - WIRE_HEADER_MAX;
+    }
+    return size;
+}
+
+/* the highest frame size level the link can carry */
+static int sizeTop(int link)
+{
+    size_t limit = fragmentLimit(link);
+    int top = 0;
+
+    while (top < SIZE_LEVELS - 1 && ((size_t)SIZE_MIN << (top + 1)) <= limit)
+    {
+        top++;
+    }
+    return top;
+}
+
+/* the data a frame at a size level carries, the top one takes all
+ * the link allows */
+static size_t sizeOf(int link, int level)
+{
+    size_t limit = fragmentLimit(link);
+
+    if (level == sizeTop(link) || ((size_t)SIZE_MIN << level) > limit)
+    {
+        return limit;
+    }
+    return (size_t)SIZE_MIN << level;
+}
+
+/* the piece of a message each frame on the link carries now */
+static size_t fragmentSize(int link)
+{
+    return sizeOf(link, sizeLevel[link - 1]);
+}
+
+/*
+ * the share of frames at a level we expect to be corrupted. a level
+ * without enough frames of its own is worked out from the nearest one
+ * that has them, as if each bit were as likely to go bad, so a frame
+ * twice the size gets through with the square of the chance.
+ */
+static double sizeErrors(int link, int level)
+{
+    long *frames = sizeFrames[link - 1];
+    long *bad = sizeBad[link - 1];
+    double ok;
+    int near = -1;
+    int ii;
+
+    for (ii = 0; ii < SIZE_LEVELS; ii++)
+    {
+        if (frames[ii] >= SIZE_MEASURED &&
+            (near < 0 || abs(ii - level) < abs(near - level)))
+        {
+            near = ii;
+        }
+    }
+    if (near < 0)
+    {
+        return 0.0;
+    }
+
+    ok = 1.0 - (double)bad[near] / frames[near];
+    for (ii = near; ii < level; ii++)
+    {
+        ok *= ok;
+    }
+    for (ii = near; ii > level; ii--)
+    {
+        /* about the square root, near enough when errors are few */
+        ok = 1.0 - (1.0 - ok) / 2;
+    }
+    return 1.0 - ok;
+}
+
+/*
+ * the data we expect to get across per second at a size level. the
+ * window holds a number of frames, so on a long link small ones can
+ * leave the line idle, and every corrupt frame sends the whole window
+ * again.
+ */
+static double sizeGoodput(int link, int level)
+{
+    double size = sizeOf(link, level);
+    double frame = size + SIZE_OVERHEAD;
+    double line = linkinfo[link].bandwidth / 8.0;
+    double rtt = 2 * linkinfo[link].propagationdelay / 1000000.0 +
+        frame / line;
+    double rate = windowSize[link - 1] * frame / rtt;
+    double p = sizeErrors(link, level);
+
+    if (rate > line)
+    {
+        rate = line;
+    }
+    return rate * size / frame * (1.0 - p) / (1.0 + windowSize[link - 1] * p);
+}
+
+/* move to another frame size if it looks enough better than this one */
+static void sizeChoose(int link)
+{
+    int current = sizeLevel[link - 1];
+    int best = current;
+    double now = sizeGoodput(link, current);
+    double bestRate = now;
+    double rate;
+    int level;
+
+    for (level = 0; level <= sizeTop(link); level++)
+    {
+        rate = sizeGoodput(link, level);
+        if (level != current && rate > bestRate &&
+            rate > now * (sizeFrames[link - 1][level] >= SIZE_MEASURED ?
+                1.125 : 1.25))
+        {
+            best = level;
+            bestRate = rate;
+        }
+    }
+    if (best != current)
+    {
+        printf("DATALINK: Link %d frames now %d bytes, %.1f%% were corrupt\n",
+                link, (int)sizeOf(link, best),
+                100.0 * sizeErrors(link, current));
+        sizeLevel[link - 1] = best;
+    }
+}
+
+/* the level of a frame len bytes on the wire, -1 for ACKs and the
+ * like, too small to say much about data frames */
+static int sizeLevelOf(size_t len)
+{
+    int level = 0;
+
+    if (len < SIZE_MIN)
+    {
+        return -1;
+    }
+    while (level < SIZE_LEVELS - 1 &&
+           len > ((size_t)SIZE_MIN << level) + SIZE_OVERHEAD)
+    {
+        level++;
+    }
+    return level;
+}
+
+/* count a frame of len bytes that arrived on the link, and whether
+ * it was corrupt, for the next ACKs to report */
+static void sizeSample(int link, size_t len, int corrupt)
+{
+    int level = sizeLevelOf(len);
+
+    if (level >= 0)
+    {
+        sizeSeen[link - 1][level]++;
+        sizeCorrupt[link - 1][level] += corrupt;
+    }
+}
+
+/*
+ * fill in an ACK's report: the totals received at one level, taking
+ * each level that has had frames in turn, seen 0 for none. seen also
+ * carries the level. totals rather than counts since the last ACK, so
+ * a lost ACK loses nothing.
+ */
+static void sizeReport(int link, Frame *f)
+{
+    int ii;
+    int level;
+
+    f->seen = 0;
+    f->corrupt = 0;
+    for (ii = 0; ii < SIZE_LEVELS; ii++)
+    {
+        level = (sizeNext[link - 1] + ii) % SIZE_LEVELS;
+        if (sizeSeen[link - 1][level] > 0)
+        {
+            sizeNext[link - 1] = (level + 1) % SIZE_LEVELS;
+            f->seen = 1 + (int)(sizeSeen[link - 1][level] % SIZE_WRAP) *
+                SIZE_LEVELS + level;
+            f->corrupt = (int)(sizeCorrupt[link - 1][level] % SIZE_WRAP);
+            return;
+        }
+    }
+}
+
+/* the other end reports how many of our frames it has had at a level
+ * and how many were corrupt, count what is new since the last report */
+static void sizeHear(int link, const Frame *f)
+{
+    int level;
+    long seen;
+    long corrupt;
+
+    if (f->seen <= 0)
+    {
+        return;
+    }
+    level = (f->seen - 1) % SIZE_LEVELS;
+    seen = (f->seen - 1) / SIZE_LEVELS;
+    corrupt = f->corrupt;
+    if (sizeHeardSeen[link - 1][level] >= 0)
+    {
+        long frames = (seen - sizeHeardSeen[link - 1][level] + SIZE_WRAP) %
+            SIZE_WRAP;
+        long bad = (corrupt - sizeHeardCorrupt[link - 1][level] + SIZE_WRAP) %
+            SIZE_WRAP;
+
+        /* the other end rebooted and started again */
+        if (frames >= SIZE_WRAP / 2 || bad > frames)
+        {
+            frames = 0;
+            bad = 0;
+        }
+        sizeFrames[link - 1][level] += frames;
+        sizeBad[link - 1][level] += bad;
+        if (sizeFrames[link - 1][level] >= SIZE_SAMPLES)
+        {
+            sizeFrames[link - 1][level] /= 2;
+            sizeBad[link - 1][level] /= 2;
+        }
+        sizeCount[link - 1] += frames;
+        if (sizeCount[link - 1] >= SIZE_CHOOSE)
+        {
+            sizeCount[link - 1] = 0;
+            sizeChoose(link);
+        }
+    }
+    sizeHeardSeen[link - 1][level] = seen;
+    sizeHeardCorrupt[link - 1][level] = corrupt;
+}
+
+/* how many frames len bytes of message take on the link */
+static int fragmentsFor(int link, size_t len)
+{
+    size_t size = fragmentSize(link);
+
+    return len == 0 ? 1 : (int)((len + size - 1) / size);
+}
+
+/* are there data frames waiting for the link's window */
+static int queuedData(int link)
+{
+    Frameclass c;
+
+    for (c = TC_INTERACTIVE; c < NUM_CLASSES; c++)
+    {
+        if (queue[link - 1][c].used > 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * how many more frames we can take in from a link. whatever we
+ * relay waits in another link's queue, which every incoming link
+ * shares, so each gets its part of the fullest one once the space
+ * kept for our own messages is taken out.
+ */
+static int rxCredit(int link)
+{
+    int sharing = nodeinfo.nlinks > 2 ? nodeinfo.nlinks - 1 : 1;
+    int credit = windowSize[link - 1];
+    int other;
+    int space;
+    Frameclass c;
+
+    for (other = 1; other <= nodeinfo.nlinks; other++)
+    {
+        if (other == link)
+        {
+            continue;
+        }
+        for (c = TC_INTERACTIVE; c < NUM_CLASSES; c++)
+        {
+            space = queueSpace(other, c) - (ownShare() - ownQueued[other - 1][c]);
+            if (space < 0)
+            {
+                space = 0;
+            }
+            if (space / sharing < credit)
+            {
+                credit = space / sharing;
+            }
+        }
+    }
+    return credit;
+}
+
+/* the class a frame has to wait in, behind the rest of its flow */
+static Frameclass queueClass(int link, Frame f)
+{
+    if (f.fclass >= TC_INTERACTIVE && flowQueued[link - 1][FLOW(f)] > 0)
+    {
+        return flowClass[link - 1][FLOW(f)];
+    }
+    return f.fclass;
+}
+
+/* copy a frame into a buffer at the back of its class, check
+ * queueRoom() first */
+static void enqueue(int link, Frame f)
+{
+    PROF_FUNC();
+    FrameQueue *q = &queue[link - 1][f.fclass];
+    Frame *b = poolGet(link);
+
+    *b = f;
+    q->frames[(q->head + q->used) % QUEUE_LENGTH] = b;
+    q->used++;
+
+    /* control frames jump the queue, they don't hold a flow's place */
+    if (f.fclass >= TC_INTERACTIVE)
+    {
+        flowQueued[link - 1][FLOW(f)]++;
+        flowClass[link - 1][FLOW(f)] = f.fclass;
+    }
+    if (f.src_addr == nodeinfo.nodenumber)
+    {
+        ownQueued[link - 1][f.fclass]++;
+    }
+}
+
+/* take the frame at the front of a class, its buffer stays with
+ * the link until poolPut() */
+static Frame *dequeue(int link, Frameclass fclass)
+{
+    FrameQueue *q = &queue[link - 1][fclass];
+    Frame *f = q->frames[q->head];
+
+    q->head = (q->head + 1) % QUEUE_LENGTH;
+    q->used--;
+
+    if (fclass >= TC_INTERACTIVE)
+    {
+        flowQueued[link - 1][FLOW(*f)]--;
+    }
+    if (f->src_addr == nodeinfo.nodenumber)
+    {
+        ownQueued[link - 1][fclass]--;
+    }
+    return f;
+}
+
+/*
+ * choose the next frame to go into the window. control and
+ * routing frames are strict priority, the data classes share
+ * the link by deficit round robin. returns 0 if nothing waits.
+ */
+static int scheduleNext(int link, Frame **f)
+{
+    PROF_FUNC();
+    int l = link - 1;
+    int c;
+    int waiting = 0;
+
+    for (c = TC_CONTROL; c <= TC_ROUTING; c++)
+    {
+        if (queue[l][c].used > 0)
+        {
+            *f = dequeue(link, c);
+            return 1;
+        }
+    }
+
+    for (c = TC_INTERACTIVE; c < NUM_CLASSES; c++)
+    {
+        waiting += queue[l][c].used;
+    }
+
+    while (waiting > 0)
+    {
+        FrameQueue *q = &queue[l][drrClass[l]];
+        c = drrClass[l];
+
+        if (q->used == 0)
+        {
+            /* an empty class can't save up credit */
+            deficit[l][c] = 0;
+        }
+        else
+        {
+            if (drrFresh[l])
+            {
+                deficit[l][c] += quantum[c];
+                drrFresh[l] = 0;
+            }
+
+            if ((int)FRAME_SIZE(*q->frames[q->head]) <= deficit[l][c])
+            {
+                deficit[l][c] -= FRAME_SIZE(*q->frames[q->head]);
+                *f = dequeue(link, c);
+                return 1;
+            }
+        }
+
+        /* on to the next class for its turn */
+        drrClass[l] = drrClass[l] + 1 < NUM_CLASSES ? drrClass[l] + 1 : TC_INTERACTIVE;
+        drrFresh[l] = 1;
+    }
+    return 0;
+}
+
+/*
+ * pass on a frame that isn't for us, cutting it up again if
+ * the next link carries less than the last one did
+ */
+static void network_forward(Frame f, int link)
+{
+    PROF_FUNC();
+    size_t size = fragmentSize(link);
+    Frame piece = f;
+    size_t done;
+
+    if (f.len <= size)
+    {
+        datalink_down(f, DL_DATA, 0, link);
+        return;
+    }
+
+    for (done = 0; done < f.len; done += piece.len)
+    {
+        piece.offset = f.offset + done;
+        piece.len = f.len - done < size ? f.len - done : size;
+        memcpy(piece.data, f.data + done, piece.len);
+        datalink_down(piece, DL_DATA, 0, link);
+    }
+}
+
+/* hand a whole message up to the application */
+static void deliver(char *data, size_t len)
+{
+    printf("message of size %zu about to be written to application\n", len);
+
+    if (trafficMode == TRAFFIC_CNET)
+    {
+        CHECK(CNET_write_application(data, &len));
+    }
+    else
+    {
+        traffic_deliver(data, len);
+    }
+}
+
+/* the slot a fragment belongs in, or a free one if its message
+ * hasn't been seen yet. NULL if there is neither */
+static Reassembly *findReassembly(Frame f)
+{
+    Reassembly *unused = NULL;
+    int ii;
+
+    for (ii = 0; ii < REASSEMBLY_SLOTS; ii++)
+    {
+        if (!reassembly[ii].used)
+        {
+            if (unused == NULL)
+            {
+                unused = &reassembly[ii];
+            }
+        }
+        else if (reassembly[ii].src == f.src_addr &&
+                 reassembly[ii].msgId == f.msgId &&
+                 reassembly[ii].epoch == f.epoch)
+        {
+            return &reassembly[ii];
+        }
+    }
+    return unused;
+}
+
+/* could we take this fragment of one of our messages right now */
+static int reassemblyRoom(Frame f)
+{
+    return (f.offset == 0 && f.len == f.total) || findReassembly(f) != NULL;
+}
+
+/* add a fragment to its message, delivering it once it is whole */
+static void reassemble(Frame f)
+{
+    PROF_FUNC();
+    Reassembly *r = findReassembly(f);
+
+    if (r == NULL || f.total > MAX_MESSAGE || f.offset + f.len > f.total)
+    {
+        printf("NETWORK: Can't reassemble message %d from %d, fragment dropped\n",
+                f.msgId, f.src_addr);
+        return;
+    }
+
+    /* a message's fragments follow each other down one path, anything
+     * else is a copy of one rerouted after a link went down */
+    if (f.offset != (r->used ? r->received : 0))
+    {
+        printf("NETWORK: Fragment of message %d from %d out of order, dropped\n",
+                f.msgId, f.src_addr);
+        return;
+    }
+
+    if (!r->used)
+    {
+        r->used = 1;
+        r->src = f.src_addr;
+        r->flow = f.flow;
+        r->segment = f.segment;
+        r->tseq = f.tseq;
+        r->msgId = f.msgId;
+        r->epoch = f.epoch;
+        r->received = 0;
+        r->total = f.total;
+
+        if (!reassemblyTimer)
+        {
+            CNET_start_timer(EV_TIMER6, REASSEMBLY_TIMEOUT / 4, 0);
+            reassemblyTimer = 1;
+        }
+    }
+
+    memcpy(r->data + f.offset, f.data, f.len);
+    r->received += f.len;
+    r->updated = nodeinfo.time_in_usec;
+    printf("NETWORK: Fragment of message %d from %d, %zu of %zu bytes\n",
+            f.msgId, f.src_addr, r->received, r->total);
+
+    if (r->received >= r->total)
+    {
+        r->used = 0;
+        transport_ready(r->src, r->epoch, r->flow, r->segment, r->tseq,
+                r->data, r->total);
+    }
+}
+
+/*
+ * give up on messages whose fragments have stopped arriving so
+ * their slots can be used again
+ */
+static void reassembly_timeout(CnetEvent ev, CnetTimerID timer, CnetData data)
+{
+    PROF_FUNC();
+    CHECKPOINT_EVENT();
+    int ii;
+    int waiting = 0;
+
+    for (ii = 0; ii < REASSEMBLY_SLOTS; ii++)
+    {
+        Reassembly *r = &reassembly[ii];
+
+        if (!r->used)
+        {
+            continue;
+        }
+        if (nodeinfo.time_in_usec - r->updated >= REASSEMBLY_TIMEOUT)
+        {
+            printf("NETWORK: Gave up on message %d from %d with %zu of %zu bytes\n",
+                    r->msgId, r->src, r->received, r->total);
+            r->used = 0;
+        }
+        else
+        {
+            waiting++;
+        }
+    }
+
+    reassemblyTimer = waiting > 0;
+    if (reassemblyTimer)
+    {
+        CNET_start_timer(EV_TIMER6, REASSEMBLY_TIMEOUT / 4, 0);
+    }
+}
+
+/*
+ * share a multicast's destinations out between the links their paths
+ * start on, split[link - 1] gets those for the link. we and any node
+ * we can't reach are left out. returns how many links have some.
+ */
+static int splitDests(const Frame *f, unsigned char split[MAX_LINKS][DEST_BYTES])
+{
+    CnetAddr addr;
+    int link;
+    int links = 0;
+    int used[MAX_LINKS] = { 0 };
+
+    memset(split, 0, MAX_LINKS * DEST_BYTES);
+    for (addr = 0; addr < NUM_NODES; addr++)
+    {
+        if (addr == nodeinfo.nodenumber || !destHas(f, addr))
+        {
+            continue;
+        }
+        link = routeLink(f->src_addr, addr, f->flow);
+        if (link == 0)
+        {
+            printf("NETWORK: No way to %d, left out of multicast\n", addr);
+            continue;
+        }
+        if (!used[link - 1])
+        {
+            used[link - 1] = 1;
+            links++;
+        }
+        split[link - 1][addr / 8] |= 1 << (addr % 8);
+    }
+    return links;
+}
+
+/* give a multicast frame one link's share of its destinations,
+ * addressed to the first of them. 0 if the share is empty */
+static int useDests(Frame *f, const unsigned char *dests)
+{
+    CnetAddr addr;
+
+    memcpy(f->dests, dests, DEST_BYTES);
+    for (addr = 0; addr < NUM_NODES; addr++)
+    {
+        if (destHas(f, addr))
+        {
+            f->dest_addr = addr;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* could we take a multicast frame, a copy on every link its
+ * destinations go by and one for us if we are one of them */
+static int multicastSpace(Frame f)
+{
+    unsigned char split[MAX_LINKS][DEST_BYTES];
+    Frame copy = f;
+    int link;
+
+    if (destHas(&f, nodeinfo.nodenumber) && !reassemblyRoom(f))
+    {
+        return 0;
+    }
+    splitDests(&f, split);
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        if (useDests(&copy, split[link - 1]) &&
+            queueSpace(link, queueClass(link, copy)) < fragmentsFor(link, f.len))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* send a multicast on, one copy down each link that some of the
+ * rest of its destinations are reached by */
+static void multicast_route(Frame f)
+{
+    unsigned char split[MAX_LINKS][DEST_BYTES];
+    int link;
+
+    splitDests(&f, split);
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        if (useDests(&f, split[link - 1]))
+        {
+            f.fclass = queueClass(link, f);
+            network_forward(f, link);
+        }
+    }
+}
+
+/* send a frame that isn't for us on towards its destination */
+static void network_route(Frame f)
+{
+    int newLink;
+
+    if (f.segment == TP_MCAST)
+    {
+        multicast_route(f);
+        return;
+    }
+
+    newLink = routeLink(f.src_addr, f.dest_addr, f.flow);
+
+    if (newLink == 0)
+    {
+        printf("NETWORK: No way to %d, frame dropped\n", f.dest_addr);
+        return;
+    }
+
+    /* pass a new datalink_down through */
+    network_forward(f, newLink);
+}
+
+/**
+ * Network and application layer for receiver
+ */
+static void network_ready(Frame f, size_t length, int link)
+{
+    PROF_FUNC();
+    if (f.segment == TP_MCAST)
+    {
+        /* the rest of the set first, then our own copy */
+        network_route(f);
+        if (!destHas(&f, nodeinfo.nodenumber))
+        {
+            return;
+        }
+    }
+    /* check if this is out node, or if we need to route it */
+    else if (nodeinfo.nodenumber != f.dest_addr)
+    {
+        printf("NETWORK: We got a node for %d seq %d, we are %d\n         It came from link #%d\n",
+                f.dest_addr, f.seq, nodeinfo.nodenumber, link);
+        network_route(f);
+        return;
+    }
+
+    if (f.offset == 0 && f.len == f.total)
+    {
+        /* this is our frame, and the whole message */
+        printf("this is our frame\n");
+        transport_ready(f.src_addr, f.epoch, f.flow, f.segment, f.tseq,
+                f.data, f.len);
+    }
+    else
+    {
+        reassemble(f);
+    }
+
+}
+
+/* go back N, everything still in the window goes again */
+static void resendWindow(int link)
+{
+    int ii;
+
+    physical_flush(link);
+    for (ii = 0; ii < windowUsed[link - 1]; ii++)
+    {
+        Frame f = *window[link - 1][ii];
+
+        f.more |= ii + 1 < windowUsed[link - 1];
+        transmitFrame(link, f);
+    }
+    linkResent[link - 1] += windowUsed[link - 1];
+    resentAt[link - 1] = nodeinfo.time_in_usec;
+    resentSeq[link - 1] = window[link - 1][0]->seq;
+    restartTimer(link, frameTime(link, *window[link - 1][0]));
+}
+
+/* time from a frame going into the window to its ACK, unless the
+ * window has been sent again since and the ACK could be for either */
+static void rttSample(int link, int seq)
+{
+    CnetTime sentAt = linkSentAt[link - 1][seq];
+    CnetTime sample = nodeinfo.time_in_usec - sentAt;
+
+    if (resentAt[link - 1] >= sentAt)
+    {
+        return;
+    }
+    if (linkSrtt[link - 1] == 0)
+    {
+        linkSrtt[link - 1] = sample;
+    }
+    else
+    {
+        linkSrtt[link - 1] += (sample - linkSrtt[link - 1]) / 8;
+    }
+}
+
+/*
+ * the receiver has told us it is missing the oldest frame in the
+ * window, go back to it now rather than waiting for the timer. if
+ * we already went back to that frame within a round trip the NAK
+ * is about frames that are still on their way, so it is ignored.
+ */
+static void fastRetransmit(int link)
+{
+    if (windowUsed[link - 1] == 0)
+    {
+        return;
+    }
+    if (resentAt[link - 1] > 0 &&
+        resentSeq[link - 1] == window[link - 1][0]->seq &&
+        nodeinfo.time_in_usec - resentAt[link - 1] < roundTrip(link))
+    {
+        printf("DATALINK: NAK on link %d suppressed\n", link);
+        return;
+    }
+
+    printf("DATALINK: NAK on link %d, resending %d frames from seq %d\n",
+            link, windowUsed[link - 1], window[link - 1][0]->seq);
+    resendWindow(link);
+}
+
+/*
+ * a link has stopped answering. everything waiting for it goes
+ * another way now rather than after the transport times out.
+ */
+static void linkFailed(int link)
+{
+    int l = link - 1;
+    int inWindow = windowUsed[l];
+    Frameclass c;
+    Frame *b;
+    Frame f;
+    int ii;
+
+    printf("DATALINK: Link %d is down, rerouting %d frames\n", link, inWindow);
+    linkDown[l] = 1;
+    CNET_stop_timer(timer[l]);
+    timer[l] = NULLTIMER;
+    windowUsed[l] = 0;
+    resentAt[l] = 0;
+    physical_flush(link);
+
+    /* the rest of a message cut up for the link follows what was
+     * already queued, not ahead of it */
+    outgoing[l].sending = 1;
+    for (ii = 0; ii < inWindow; ii++)
+    {
+        f = *window[l][ii];
+        poolPut(link, window[l][ii]);
+        network_route(f);
+    }
+    for (c = TC_CONTROL; c < NUM_CLASSES; c++)
+    {
+        while (queue[l][c].used > 0)
+        {
+            b = dequeue(link, c);
+            f = *b;
+            poolPut(link, b);
+            network_route(f);
+        }
+    }
+    outgoing[l].sending = 0;
+    network_send(link);
+}
+
+/*
+ * we have heard from a link we had given up on. its window was
+ * emptied when it went down, so tell the other end where we are up
+ * to before anything new goes.
+ */
+static void linkRestored(int link)
+{
+    Frame hello;
+
+    printf("DATALINK: Link %d is back up\n", link);
+    linkDown[link - 1] = 0;
+    linkRetries[link - 1] = 0;
+
+    hello.src_addr = nodeinfo.nodenumber;
+    hello.dest_addr = nodeinfo.nodenumber;
+    hello.fclass = TC_CONTROL;
+    hello.len = 0;
+    datalink_down(hello, DL_HELLO, expectedFrame[link - 1], link);
+
+    /* a message cut up for the link while it was down can use it again */
+    network_send(link);
+}
+
+/**
+ * Data link layer for receiver
+ */
+/* ACK everything taken in order on a link so far */
+static void sendAck(int link)
+{
+    Frame ack;
+
+    ack.src_addr = nodeinfo.nodenumber;
+    ack.dest_addr = nodeinfo.nodenumber;
+    ack.len = 0;
+    datalink_down(ack, DL_ACK, nextToReceive[link - 1], link);
+}
+
+/*
+ * a frame has been taken in order. one-way traffic has nothing to
+ * carry the ACK back, so while the sender says more is coming the ACK
+ * waits for ACK_EVERY frames, or fewer if the sender would run out of
+ * window or credit before then. if no more come within two of its
+ * times on the line, EV_TIMER10 sends it, well inside the sender's
+ * timeout of three.
+ */
+static void datalink_accept(int link, int more, size_t length)
+{
+    int l = link - 1;
+    int every = ACK_EVERY;
+
+    nextToReceive[l] = nextReceive(link);
+    nakSent[l] = 0;
+    if (bestEffort)
+    {
+        return;
+    }
+
+    ackPending[l]++;
+    if (windowSize[l] / 2 < every)
+    {
+        every = windowSize[l] / 2;
+    }
+    if (rxAdvertised[l] / 2 < every)
+    {
+        every = rxAdvertised[l] / 2;
+    }
+    if (!more || ackPending[l] >= every)
+    {
+        sendAck(link);
+    }
+    else if (ackTimer[l] == NULLTIMER)
+    {
+        ackTimer[l] = CNET_start_timer(EV_TIMER10, 2 * txTime(link, length),
+                (CnetData)link);
+    }
+}
+
+static void datalink_ready(int link, Frame f, size_t length)
+{
+    PROF_FUNC();
+    int ii;
+    int accepted = 0;
+
+    /* anything that gets through shows the link works */
+    lastHeard[link - 1] = nodeinfo.time_in_usec;
+    if (linkDown[link - 1])
+    {
+        linkRestored(link);
+    }
+
+    /* check what type of frame we have received */
+    switch (f.kind) {
+
+        /* we got an ACK check what frame we are on */
+        case DL_ACK:
+        case DL_NAK:
             // we received an ACK. Check what was the next
             // link in the buffer.
 
-            // check from our final frame looping down for
-            // the value f.seq 
-            for (ii = windowUsed[link - 1]; ii >= 0; ii--)
-            {
-                if (accepted == 0)
-                {
-                    if (window[link - 1][ii].seq == f.seq)
-                    {
-                        // we have gotten acceptance up to this point 
+            // ACKs are cumulative, look for f.seq from the
+            // oldest frame in the window
+            for (ii = 0; ii < windowUsed[link - 1]; ii++)
+            {
+                if (accepted == 0)
+                {
+                    if (window[link - 1][ii]->seq == f.seq)
+                    {
+                        // we have gotten acceptance up to this point 
+
+                        // accepted now contains number of frames that
+                        // have been accepted
+                        accepted = ii + 1;
+                        printf("DATALINK: We have accepted %d frames\n", accepted);
+                    }
+                }
+            }
+
+            // if we have received acceptance remove x number of frames
+            // from the window
+            if (accepted != 0)
+            {
+                int jj;
+
+                linkRetries[link - 1] = 0;
+                rttSample(link, window[link - 1][accepted - 1]->seq);
+                for (jj = 0; jj < accepted; jj++)
+                {
+                    poolPut(link, window[link - 1][jj]);
+                }
+                for (jj = 0; jj < (windowUsed[link - 1] - accepted); jj++)
+                {
+                    window[link - 1][jj] = window[link - 1][jj + accepted];
+                }
+
+                printf("DATALINK: Prev. window usage: %d link %d\n", 
+                        windowUsed[link - 1], link);
+                windowUsed[link - 1] = windowUsed[link - 1] - accepted;
+                printf("DATALINK: New window usage: %d link %d\n", 
+                        windowUsed[link - 1], link);
+            }
+
+            /* what is left starts with the frame that went missing */
+            if (f.kind == DL_NAK)
+            {
+                fastRetransmit(link);
+            }
+
+            /* the credit counts from the frame being acked. an ACK
+             * that moves nothing on is still a credit update if it is
+             * for the newest frame acked, an older one that arrived
+             * late has out of date credit */
+            if (accepted != 0 || f.seq == lastAcked(link))
+            {
+                txCredit[link - 1] = f.credit;
+            }
+
+            if (accepted != 0)
+            {
+                /* restart the timeout for this link with the oldest
+                 * node in the queue. */
+
+                printf("DATALINK: Restarting timer on link %d\n", link);
+                restartTimer(link, frameTime(link, *window[link - 1][0]));
+            }
+            else
+            {
+                // we don't know what ACK number that is....
+                // could still be a credit update
+            }
+
+            /* the window has room, let waiting frames in */
+            datalink_send(link);
+        break;
+
+        /* the other end has nothing in flight, so its next frame
+         * follows the one it last sent whatever we missed */
+        case DL_HELLO:
+            /* sent whatever is in flight, so it says nothing of
+             * the sequence numbers */
+            if (f.fclass == TC_ROUTING)
+            {
+                routing_ready(link, f);
+                break;
+            }
+            if (!bestEffort)
+            {
+                nextToReceive[link - 1] = f.seq;
+                nakSent[link - 1] = 0;
+                txCredit[link - 1] = f.credit;
+                datalink_send(link);
+            }
+        break;
+
+        /* we got data check if it was the expected seq number
+         * and ACK it if so, now or along with the next few.
+         * If it's not, ignore it and let the timeout occur.
+         */
+        case DL_DATA :
+            printf("\t\t\t\tDATA received, seq=%d on link %d\n", f.seq, link);
+
+            /*
+             * frame expected should be the last sequence number
+             * + 1 in the window for that link. best effort links
+             * take whatever arrives */
+            if (bestEffort || f.seq == nextReceive(link))
+            {
+                
+                // ack it then push up network layer
+                //frameexpected[link] = 1 - frameexpected[link];
+
+                /* check if we need to add this to our buffer. */
+                /* or pass it along. */
+                if (f.segment == TP_MCAST)
+                {
+                    /* every copy it needs or none, the ack's credit
+                     * counts them */
+                    if (multicastSpace(f))
+                    {
+                        network_ready(f, f.len, link);
+                        datalink_accept(link, f.more, length);
+                    }
+                    else
+                    {
+                        printf("DATALINK: No room for multicast copies, ignore frame.\n");
+                    }
+                }
+                else if (f.dest_addr == nodeinfo.nodenumber && !reassemblyRoom(f))
+                {
+                    /* nowhere to put it back together, the sender
+                     * will try again */
+                    printf("DATALINK: No room to reassemble, ignore frame.\n");
+                }
+                else if (f.dest_addr == nodeinfo.nodenumber)
+                {
+                    datalink_accept(link, f.more, length);
+                    network_ready(f, f.len, link);
+                    printf("DATALINK: Passing packet up to network. size:%zu\n", f.len);
+                }
+                else if (routeLink(f.src_addr, f.dest_addr, f.flow) == 0)
+                {
+                    /* every way on is down, take it off the link
+                     * so the link itself isn't blamed */
+                    datalink_accept(link, f.more, length);
+                    printf("DATALINK: No way to %d, frame dropped\n", f.dest_addr);
+                }
+                else
+                {
+                    int newLink = routeLink(f.src_addr, f.dest_addr, f.flow);
+                    /* 
+                     * we will need to do some routing. 
+                     * work out if we have room for it
+                     */
+                    f.fclass = queueClass(newLink, f);
+                    if (queueSpace(newLink, f.fclass) >= fragmentsFor(newLink, f.len))
+                    {
+                        /* datalink_down queues the frame behind
+                         * others of its class */
+                        network_forward(f, newLink);
+
+                        // ack it, there is room in the queue, the
+                        // credit in the ack counts this frame
+                        datalink_accept(link, f.more, length);
+
+                        printf("DATALINK: Frame queued\n");
+                    }
+                    else
+                    {
+                        /* we don't have room for it */
+                        /* ignore it */
+                        printf("DATALINK: Queue exhasted, ignore frame.\n");
+                    }
+                }
+            }
+            else
+            {
+                /* we didn't get the correct one, NAK the last we
+                 * received. only once per gap, the rest of the
+                 * window behind it is out of order too */
+                printf("Unexpected sequence number %d want %d\n", 
+                        f.seq, nextReceive(link));
+
+                if (!nakSent[link - 1])
+                {
+                    Frame nak;
+                    nak.src_addr = nodeinfo.nodenumber;
+                    nak.dest_addr = f.src_addr;
+                    nak.len = 0;
+
+                    datalink_down(nak, DL_NAK, nextToReceive[link - 1], link);
+                    nakSent[link - 1] = 1;
+                }
+            }
+        break;
+    }
+}
+
+/**
+ *  Physical Layer Receiver
+ */
+static void physical_receive(int link, unsigned char *wire, size_t len)
+{
+    Frame f;
+
+    /* damaged, cut short or not one of ours */
+    if (!frame_decode(wire, len, &f))
+    {
+        printf("\t\t\t\tBAD checksum - frame ignored\n");
+        linkCorrupt[link - 1]++;
+        sizeSample(link, len, 1);
+        return;
+    }
+    sizeSample(link, len, 0);
+    if (f.kind != DL_DATA)
+    {
+        sizeHear(link, &f);
+    }
+
+    printf("PHYSICAL: Just received a frame of %zu bytes\n", len);
+    printFrame(link, &f, len);
+
+    datalink_ready(link, f, len);
+}
+
+static void physical_ready(CnetEvent ev, CnetTimerID timer, CnetData data)
+{
+    PROF_FUNC();
+    CHECKPOINT_EVENT();
+    int link;
+    unsigned char wire[WIRE_FRAME_MAX];
+    size_t len;
+    CnetTime delay;
+
+    len = sizeof(wire);
+
+    CHECK(CNET_read_physical(&link, wire, &len));
+
+    switch (impair_frame(link, nodeinfo.time_in_usec, &delay))
+    {
+        case IMPAIR_LOSE:
+            printf("PHYSICAL: Impaired frame lost on link %d\n", link);
+            return;
+
+        case IMPAIR_DUPLICATE:
+            physical_receive(link, wire, len);
+            break;
+
+        case IMPAIR_DELAY:
+            if (heldCount < HELD_FRAMES)
+            {
+                HeldFrame *h = &held[heldCount++];
+
+                h->until = nodeinfo.time_in_usec + delay;
+                h->link = link;
+                h->len = len;
+                memcpy(h->wire, wire, len);
+                CNET_start_timer(EV_TIMER10, delay, 0);
+                return;
+            }
+            break;
+
+        case IMPAIR_PASS:
+            break;
+    }
+    physical_receive(link, wire, len);
+}
+
+/* deliver the held frames that are due, earliest first */
+static void physical_release(void)
+{
+    HeldFrame h;
+    int first;
+    int ii;
+
+    for (;;)
+    {
+        first = -1;
+        for (ii = 0; ii < heldCount; ii++)
+        {
+            if (held[ii].until <= nodeinfo.time_in_usec &&
+                (first < 0 || held[ii].until < held[first].until))
+            {
+                first = ii;
+            }
+        }
+        if (first < 0)
+        {
+            return;
+        }
+        h = held[first];
+        held[first] = held[--heldCount];
+        physical_receive(h.link, h.wire, h.len);
+    }
+}
+
+/*
+ * EV_TIMER10 is shared. a link's delayed ACK carries the link, and
+ * frames IMPAIR held back carry 0
+ */
+static void delay_timeout(CnetEvent ev, CnetTimerID timer, CnetData data)
+{
+    PROF_FUNC();
+    CHECKPOINT_EVENT();
+    int link = (int)data;
+
+    if (link == 0)
+    {
+        physical_release();
+        return;
+    }
+    ackTimer[link - 1] = NULLTIMER;
+    if (ackPending[link - 1] > 0)
+    {
+        sendAck(link);
+    }
+}
+
+/* how long a frame of len bytes keeps the line busy */
+static CnetTime txTime(int link, size_t len)
+{
+    return (CnetTime)len * 8000000 / linkinfo[link].bandwidth;
+}
+
+/*
+ * write out waiting frames while the line is free, ACKs first, and
+ * come back on EV_TIMER9 when the one going out has finished
+ */
+static void physical_send(int link)
+{
+    PROF_FUNC();
+    int l = link - 1;
+    CnetTime now = nodeinfo.time_in_usec;
+    TxQueue *q;
+    TxFrame *t;
+    size_t length;
+
+    if (txWaiting[l])
+    {
+        return;
+    }
+    while (txQueue[l][TX_CONTROL].used > 0 || txQueue[l][TX_DATA].used > 0)
+    {
+        if (now < busyUntil[l])
+        {
+            CNET_start_timer(EV_TIMER9, busyUntil[l] - now, (CnetData)link);
+            txWaiting[l] = 1;
+            return;
+        }
+
+        q = &txQueue[l][txQueue[l][TX_CONTROL].used > 0 ? TX_CONTROL : TX_DATA];
+        t = &q->frames[q->head];
+        length = t->len;
+
+        /* a link that is down loses the frame like any other, the
+         * keepalives and timeouts notice */
+        if (CNET_write_physical(link, t->wire, &length) != 0)
+        {
+            if (cnet_errno == ER_TOOBUSY)
+            {
+                busyUntil[l] = now + TX_RETRY;
+                continue;
+            }
+            printf("PHYSICAL: Can't write to link %d, %s\n", link,
+                    cnet_errstr[cnet_errno]);
+        }
+        else
+        {
+            busyUntil[l] = now + txTime(link, t->len);
+            linkFrames[l]++;
+            linkBytes[l] += t->len;
+        }
+        q->head = (q->head + 1) % q->length;
+        q->used--;
+    }
+}
+
+/*
+ * the line is free again, send the next frame. a best effort link
+ * has no window holding it back, so it takes the next one from its
+ * queues now.
+ */
+static void physical_timeout(CnetEvent ev, CnetTimerID timer, CnetData data)
+{
+    PROF_FUNC();
+    CHECKPOINT_EVENT();
+    int link = (int)data;
+
+    txWaiting[link - 1] = 0;
+    physical_send(link);
+    if (bestEffort)
+    {
+        datalink_send(link);
+    }
+}
+
+/* give each link's queues their frames, a window's worth each */
+static void physical_init(void)
+{
+    TxFrame *next;
+    int frames = 0;
+    int link;
+    int k;
+
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        frames += TX_QUEUES * windowSize[link - 1];
+    }
+    free(txFrames);
+    txFrames = calloc(frames, sizeof(TxFrame));
+
+    next = txFrames;
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        for (k = 0; k < TX_QUEUES; k++)
+        {
+            txQueue[link - 1][k].frames = next;
+            txQueue[link - 1][k].length = windowSize[link - 1];
+            txQueue[link - 1][k].head = 0;
+            txQueue[link - 1][k].used = 0;
+            next += windowSize[link - 1];
+        }
+    }
+}
+
+/* data frames on a link that haven't gone out yet, a best effort
+ * link takes no more until they have */
+static int physical_waiting(int link)
+{
+    return txQueue[link - 1][TX_DATA].used;
+}
+
+/* forget data frames that haven't gone out yet, the window is about
+ * to send them all again or they are going another way */
+static void physical_flush(int link)
+{
+    txQueue[link - 1][TX_DATA].head = 0;
+    txQueue[link - 1][TX_DATA].used = 0;
+}
+
+/**
+ * physical layer sender
+ */
+static void physical_down(int link, Frame f)
+{
+    PROF_FUNC();
+    TxQueue *q = &txQueue[link - 1][f.kind == DL_DATA ? TX_DATA : TX_CONTROL];
+    TxFrame *t;
+
+    if (q->used == q->length)
+    {
+        printf("PHYSICAL: Line %d backed up, frame dropped\n", link);
+        return;
+    }
+    t = &q->frames[(q->head + q->used) % q->length];
+    t->len = frame_encode(&f, t->wire);
+    q->used++;
+    printf("PHYSICAL: Trying to transmit frame of size %zu\n", t->len);
+    printFrame(link, &f, t->len);
+
+    physical_send(link);
+}
+
+/*
+ * hand a frame to the physical layer, which checksums it as it
+ * writes it out
+ */
+static void transmitFrame(int link, Frame f)
+{
+    printf("DATALINK DOWN: frame size: %zu of type: %d\n", FRAME_SIZE(f), f.kind);
+
+    lastSent[link - 1] = nodeinfo.time_in_usec;
+
+    physical_down(link, f);
+}
+
+/*
+ * the queue on a link has drained, tell any neighbour we had
+ * stopped that it can send to us again.
+ */
+static void creditUpdate(int link)
+{
+    int other;
+    Frame ack;
+
+    for (other = 1; other <= nodeinfo.nlinks; other++)
+    {
+        if (other != link && !linkDown[other - 1] &&
+            rxAdvertised[other - 1] == 0 && rxCredit(other) > 0)
+        {
+            printf("DATALINK: Credit open again on link %d\n", other);
+            ack.src_addr = nodeinfo.nodenumber;
+            ack.dest_addr = nodeinfo.nodenumber;
+            ack.len = 0;
+            datalink_down(ack, DL_ACK, nextToReceive[other - 1], other);
+        }
+    }
+}
+
+/* frames in the window that the peer's credit covers. control frames
+ * are left out, they are what frees the peer's buffers so they can't
+ * be made to wait for them */
+static int windowCredited(int link)
+{
+    int credited = 0;
+    int ii;
+
+    for (ii = 0; ii < windowUsed[link - 1]; ii++)
+    {
+        if (window[link - 1][ii]->fclass != TC_CONTROL)
+        {
+            credited++;
+        }
+    }
+    return credited;
+}
+
+/*
+ * move queued frames into the window while it has room,
+ * giving each its sequence number as it goes out. control
+ * frames only need room in the window, the rest credit too.
+ */
+static void datalink_send(int link)
+{
+    PROF_FUNC();
+    Frame *f;
+    int sent = 0;
+    int credited;
+
+    if (bestEffort)
+    {
+        /* no window to wait for, queued frames go as fast as the
+         * line takes them */
+        while (physical_waiting(link) == 0 && scheduleNext(link, &f))
+        {
+            transmitFrame(link, *f);
+            poolPut(link, f);
+            sent++;
+        }
+        if (sent > 0)
+        {
+            application_resume(link);
+        }
+        return;
+    }
+
+    credited = windowCredited(link);
+    while (windowUsed[link - 1] < windowSize[link - 1] &&
+           (credited < txCredit[link - 1] ||
+            queue[link - 1][TC_CONTROL].used > 0) &&
+           scheduleNext(link, &f))
+    {
+        if (f->fclass != TC_CONTROL)
+        {
+            credited++;
+        }
+        printf("DATALINK DOWN: Old sequence # is %d\n", expectedFrame[link -1]);
+        expectedFrame[link - 1] = expectedNextFrame(link);
+        f->seq = expectedFrame[link - 1];
+
+        window[link - 1][windowUsed[link - 1]] = f;
+        windowUsed[link - 1]++;
+        linkSentAt[link - 1][f->seq] = nodeinfo.time_in_usec;
+        if (checkpoint != NULL)
+        {
+            checkpoint->window[link - 1][f->seq] = *f;
+        }
+
+        /* a relay keeps the flag from upstream */
+        if (queuedData(link))
+        {
+            f->more = 1;
+        }
+
+        printf(" DATA transmitted, seq=%d class=%d\n", f->seq, f->fclass);
+
+        transmitFrame(link, *f);
+        sent++;
+    }
+
+    if (sent > 0)
+    {
+        restartTimer(link, frameTime(link, *window[link - 1][0]));
+
+        /* the queues have room again */
+        application_resume(link);
+        creditUpdate(link);
+    }
+    else if (windowUsed[link - 1] == 0 && timer[link - 1] == NULLTIMER)
+    {
+        /* held up by credit, start asking for more */
+        restartTimer(link, 0);
+    }
+}
+
+/**
+ * Data link layer sender
+ */
+static void datalink_down(Frame f, Framekind kind, 
+                    int seqno, int link)
+{
+    PROF_FUNC();
+    // take the packet and generate a frame for it.
+    f.kind      = kind;
+    f.seq       = seqno;
+
+    switch (kind) {
+        case DL_ACK :
+        case DL_NAK :
+        case DL_HELLO :
+            /* best effort links still keep each other alive */
+            if (bestEffort && kind != DL_HELLO)
+            {
+                return;
+            }
+            f.src_addr = nodeinfo.nodenumber;
+            /* a HELLO can carry the network layer's load */
+            if (kind != DL_HELLO || f.fclass != TC_ROUTING)
+            {
+                f.fclass = TC_CONTROL;
+            }
+            f.credit = rxCredit(link);
+            sizeReport(link, &f);
+            rxAdvertised[link - 1] = f.credit;
+            if (kind != DL_HELLO)
+            {
+                ackPending[link - 1] = 0;
+                if (ackTimer[link - 1] != NULLTIMER)
+                {
+                    CNET_stop_timer(ackTimer[link - 1]);
+                    ackTimer[link - 1] = NULLTIMER;
+                }
+            }
+            printf("%s transmitted, seq=%d credit=%d\n",
+                    kind == DL_ACK ? "ACK" : kind == DL_NAK ? "NAK" :
+                    f.fclass == TC_ROUTING ? "ROUTING" : "HELLO",
+                    seqno, f.credit);
+
+            /* ACKs never wait behind data */
+            transmitFrame(link, f);
+        break;
+
+        /**
+         * we are sending a new frame with data, it waits in
+         * the queue for its class and gets a sequence number
+         * once the scheduler lets it into the window.
+         */
+        case DL_DATA:
+            f.fclass = queueClass(link, f);
+            if (!queueRoom(link, f.fclass))
+            {
+                printf("DATA: No room in queue for frame.\n");
+                /* ignore it */
+                return;
+            }
+
+            enqueue(link, f);
+            datalink_send(link);
+            break;
+    }
+}
+
+/*
+ * queue as much of a link's outgoing message as there is room
+ * for, one fragment to a frame. if the link has gone down the
+ * rest goes whichever way the message would take now.
+ */
+static void network_send(int link)
+{
+    PROF_FUNC();
+    Outgoing *o = &outgoing[link - 1];
+    int via = link;
+    size_t size;
+    Frame f;
+
+    /* frames going out come back here through application_resume(),
+     * the loop below is already doing the work */
+    if (o->sending)
+    {
+        return;
+    }
+    if (o->busy && linkDown[link - 1])
+    {
+        via = routeLink(nodeinfo.nodenumber, o->header.dest_addr, o->header.flow);
+        if (via == 0)
+        {
+            return;
+        }
+    }
+    size = fragmentSize(via);
+    o->sending = 1;
+
+    while (o->busy && ownRoom(via, queueClass(via, o->header)))
+    {
+        f = o->header;
+        f.offset = o->offset;
+        f.len = f.total - o->offset < size ? f.total - o->offset : size;
+        memcpy(f.data, o->data + o->offset, f.len);
+
+        o->offset += f.len;
+        if (o->offset == f.total)
+        {
+            o->busy = 0;
+        }
+        f.more = o->busy;
+        datalink_down(f, DL_DATA, 0, via);
+    }
+
+    o->sending = 0;
+}
+
+/* could a multicast to header's destinations go now. each link
+ * that some of them are reached by has to be free, and at least one
+ * of them has to be reachable */
+static int multicastRoom(Frame header)
+{
+    unsigned char split[MAX_LINKS][DEST_BYTES];
+    Frame copy = header;
+    int link;
+
+    header.src_addr = nodeinfo.nodenumber;
+    if (splitDests(&header, split) == 0)
+    {
+        return 0;
+    }
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        if (useDests(&copy, split[link - 1]) && outgoing[link - 1].busy)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Network layer Sender for a multicast. one copy of the message goes
+ * down each link, carrying the destinations that are reached by it.
+ * returns 0 unless every link it needs is free.
+ */
+static int network_multicast(Frame header, char *data, size_t len)
+{
+    unsigned char split[MAX_LINKS][DEST_BYTES];
+    int taken[MAX_LINKS] = { 0 };
+    Frame copy;
+    int link;
+
+    if (!multicastRoom(header))
+    {
+        return 0;
+    }
+
+    header.src_addr = nodeinfo.nodenumber;
+    header.fclass = classify(len);
+    header.msgId = messageId++;
+    header.epoch = bootEpoch;
+    header.total = len;
+    splitDests(&header, split);
+
+    /* take every link before any of them starts sending, sending can
+     * bring the transport back for another message */
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        Outgoing *o = &outgoing[link - 1];
+
+        copy = header;
+        if (useDests(&copy, split[link - 1]))
+        {
+            o->header = copy;
+            memcpy(o->data, data, len);
+            o->offset = 0;
+            o->busy = 1;
+            taken[link - 1] = 1;
+            printf("NETWORK: send multicast on link %d in %d fragments\n",
+                    link, fragmentsFor(link, len));
+        }
+    }
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        if (taken[link - 1])
+        {
+            network_send(link);
+        }
+    }
+    return 1;
+}
+
+/** 
+ * Network layer Sender. header has the destination, flow and
+ * transport fields, returns 0 if the link is still busy with
+ * the last message.
+ */
+static int network_down(Frame header, char *data, size_t len)
+{
+    PROF_FUNC();
+    int linkToUse;
+    Outgoing *o;
+    int ii;
+
+    if (header.segment == TP_MCAST)
+    {
+        return network_multicast(header, data, len);
+    }
+
+    // find which node to send it too.
+    linkToUse = routeLink(nodeinfo.nodenumber, header.dest_addr, header.flow);
+    if (linkToUse == 0)
+    {
+        return 0;
+    }
+    o = &outgoing[linkToUse - 1];
+    if (o->busy)
+    {
+        return 0;
+    }
+
+    /* the last message of the flow may still be going out on a link
+     * that has since gone down, it has to finish first */
+    for (ii = 0; ii < MAX_LINKS; ii++)
+    {
+        if (outgoing[ii].busy && outgoing[ii].header.dest_addr == header.dest_addr &&
+            outgoing[ii].header.flow == header.flow)
+        {
+            return 0;
+        }
+    }
+
+    /* encapsulate the message in a packet */
+    o->header = header;
+    o->header.src_addr = nodeinfo.nodenumber;
+    o->header.fclass = classify(len);
+    o->header.msgId = messageId++;
+    o->header.epoch = bootEpoch;
+    o->header.total = len;
+    memcpy(o->data, data, len);
+    o->offset = 0;
+    o->busy = 1;
+
+    printf("NETWORK: send packet on link %d for node %d in %d fragments\n",
+            linkToUse, header.dest_addr, fragmentsFor(linkToUse, len));
+    //printf("\tnetwork had decided to use link %d to send to %d\n", linkToUse, p.dest_addr);
+    network_send(linkToUse);
+
+    /* the rest goes as the queue drains */
+    return 1;
+}
+
+/* a segment nobody is using, NULL if they all wait for ACKs */
+static Segment *freeSegment(void)
+{
+    int ii;
+
+    for (ii = 0; ii < TRANSPORT_SEGMENTS; ii++)
+    {
+        if (!segments[ii].used)
+        {
+            return &segments[ii];
+        }
+    }
+    return NULL;
+}
+
+/* can we take another message for dest on a flow */
+static int transport_room(CnetAddr dest, int flow)
+{
+    return connection[dest][flow % TRANSPORT_FLOWS].unacked < TRANSPORT_WINDOW &&
+        freeSegment() != NULL;
+}
+
+/* does an older message of the same connection still have to go */
+static int segmentBlocked(Segment *s)
+{
+    int ii;
+
+    for (ii = 0; ii < TRANSPORT_SEGMENTS; ii++)
+    {
+        Segment *t = &segments[ii];
+
+        if (t->used && !t->queued && t->dest == s->dest &&
+            t->flow == s->flow && t->tseq < s->tseq)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * hand waiting messages to the network layer as their links free
+ * up, in order within each connection.
+ */
+static void transport_send(void)
+{
+    PROF_FUNC();
+    Frame header;
+    int progress = 1;
+    int ii;
+
+    /* network_down comes back here as frames go out */
+    if (transportSending)
+    {
+        return;
+    }
+    transportSending = 1;
+
+    while (progress)
+    {
+        progress = 0;
+        for (ii = 0; ii < TRANSPORT_SEGMENTS; ii++)
+        {
+            Segment *s = &segments[ii];
 
-                        // accepted now contains number of frames that
-                        // have been accepted
-                        accepted = (windowUsed[link - 1] - ii);
-                        printf("DATALINK: We have accepted %d frames\n", accepted);
-                    }
-                }
+            if (!s->used || s->queued || segmentBlocked(s))
+            {
+                continue;
             }
 
-            // if we have received acceptance remove x number of frames
-            // from the window
-            if (accepted != 0)
+            header.dest_addr = s->dest;
+            header.flow = s->flow;
+            header.segment = TP_DATA;
+            header.tseq = s->tseq;
+
+            s->queued = 1;
+            s->sentAt = nodeinfo.time_in_usec;
+            if (network_down(header, s->data, s->len))
             {
-                int jj;
-                for (jj = 0; jj < (windowUsed[link - 1] - accepted); jj++)
-                {
-                    window[link - 1][jj] = window[link - 1][jj + 1];
-                }
+                printf("TRANSPORT: Sent message %d to %d flow %d%s\n", s->tseq,
+                        s->dest, s->flow, s->resent ? " again" : "");
+                progress = 1;
+            }
+            else
+            {
+                s->queued = 0;
+            }
+        }
+    }
 
-                printf("DATALINK: Prev. window usage: %d link %d\n", 
-                        windowUsed[link - 1], link);
-                windowUsed[link - 1] = windowUsed[link - 1] - accepted;
-                printf("DATALINK: New window usage: %d link %d\n", 
-                        windowUsed[link - 1], link);
+    transportSending = 0;
+}
 
-                /* restart the timeout for this link with the oldest
-                 * node in the queue. */
+/**
+ * Transport layer Sender
+ */
+static void transport_down(CnetAddr dest, int flow, char *data, size_t len)
+{
+    PROF_FUNC();
+    Connection *c = &connection[dest][flow % TRANSPORT_FLOWS];
+    Segment *s = freeSegment();
 
-                printf("DATALINK: Restarting timer on link %d\n", link);
-                CnetTime timeout = FRAME_SIZE(f)
-                    *((CnetTime)8000000 / linkinfo[link].bandwidth) +
-                    linkinfo[link].propagationdelay;
-                restartTimer(link, timeout);
+    if (s == NULL || c->unacked >= TRANSPORT_WINDOW)
+    {
+        printf("TRANSPORT: No room for a message to %d, dropped\n", dest);
+        return;
+    }
 
-                /* check if the window has room and reopen application */
-                if (windowUsed[link - 1] < (windowSize - 1))
-                {
-                    CNET_enable_application(f.src_addr);
-                }
+    s->used = 1;
+    s->queued = 0;
+    s->resent = 0;
+    s->dest = dest;
+    s->flow = flow % TRANSPORT_FLOWS;
+    s->tseq = c->nextSeq++;
+    s->len = len;
+    memcpy(s->data, data, len);
+    c->unacked++;
+    checkpoint_segment(s);
+    checkpoint_connection(dest, s->flow);
+
+    if (!transportTimer)
+    {
+        CNET_start_timer(EV_TIMER7, TRANSPORT_TICK, 0);
+        transportTimer = 1;
+    }
+
+    transport_send();
+    application_update();
+}
+
+/*
+ * Transport layer Sender for a multicast. it isn't kept or acked,
+ * the links see it there. returns 0 if the network can't take it yet.
+ */
+static int transport_multicast(Frame header, char *data, size_t len)
+{
+    header.segment = TP_MCAST;
+    header.tseq = mcastNextSeq;
+    if (!network_down(header, data, len))
+    {
+        return 0;
+    }
+    mcastNextSeq++;
+    return 1;
+}
+
+/* fold a round trip into the connection's timeout */
+static void transport_rtt(Connection *c, CnetTime rtt)
+{
+    if (c->srtt == 0)
+    {
+        c->srtt = rtt;
+        c->rttvar = rtt / 2;
+    }
+    else
+    {
+        CnetTime diff = c->srtt > rtt ? c->srtt - rtt : rtt - c->srtt;
+
+        c->rttvar = (3 * c->rttvar + diff) / 4;
+        c->srtt = (7 * c->srtt + rtt) / 8;
+    }
+
+    /* steady paths show almost no variance, leave a quarter of the
+     * round trip for a queue to build */
+    c->rto = c->srtt + (4 * c->rttvar > c->srtt / 4 ? 4 * c->rttvar : c->srtt / 4);
+    if (c->rto < TRANSPORT_MIN_RTO)
+    {
+        c->rto = TRANSPORT_MIN_RTO;
+    }
+    if (!bestEffort && c->rto < TRANSPORT_RELIABLE_RTO)
+    {
+        c->rto = TRANSPORT_RELIABLE_RTO;
+    }
+    if (c->rto > TRANSPORT_MAX_RTO)
+    {
+        c->rto = TRANSPORT_MAX_RTO;
+    }
+}
+
+/* send everything a connection still has unacked again, in order */
+static void transport_goback(CnetAddr dest, int flow)
+{
+    int ii;
+
+    for (ii = 0; ii < TRANSPORT_SEGMENTS; ii++)
+    {
+        if (segments[ii].used && segments[ii].dest == dest &&
+            segments[ii].flow == flow)
+        {
+            segments[ii].queued = 0;
+            segments[ii].resent = 1;
+        }
+    }
+}
+
+/* dest has everything up to tseq on a flow, let those messages go */
+static void transport_acked(CnetAddr dest, int flow, int tseq)
+{
+    Connection *c = &connection[dest][flow];
+    int freed = 0;
+    int ii;
+
+    for (ii = 0; ii < TRANSPORT_SEGMENTS; ii++)
+    {
+        Segment *s = &segments[ii];
+
+        if (!s->used || s->dest != dest || s->flow != flow || s->tseq > tseq)
+        {
+            continue;
+        }
+        if (s->tseq == tseq && s->queued && !s->resent)
+        {
+            transport_rtt(c, nodeinfo.time_in_usec - s->sentAt);
+        }
+        s->used = 0;
+        c->unacked--;
+        freed++;
+        checkpoint_segment(s);
+    }
+    if (freed > 0)
+    {
+        checkpoint_connection(dest, flow);
+    }
+
+    if (freed > 0)
+    {
+        printf("TRANSPORT: %d acked up to message %d by %d\n", freed, tseq, dest);
+        transport_send();
+        application_update();
+    }
+}
+
+/* tell src how far we have got on a flow, TP_NAK if it has to
+ * go back */
+static void transport_ack(CnetAddr src, int flow, Segkind kind)
+{
+    Frame ack;
+    int link = routeLink(nodeinfo.nodenumber, src, flow);
+
+    /* the source will send again once it can be reached */
+    if (link == 0)
+    {
+        return;
+    }
+
+    ack.src_addr = nodeinfo.nodenumber;
+    ack.dest_addr = src;
+    ack.flow = flow;
+    ack.fclass = TC_CONTROL;
+    ack.segment = kind;
+    ack.tseq = tpExpected[src][flow] - 1;
+    ack.msgId = messageId++;
+    ack.epoch = bootEpoch;
+    ack.offset = 0;
+    ack.total = 0;
+    ack.len = 0;
+    ack.more = 0;
+
+    datalink_down(ack, DL_DATA, 0, link);
+}
+
+/*
+ * peer has booted again without its checkpoint. it wants our messages
+ * from 0 again, and its own start from 0, so every connection with it
+ * starts over. what it hadn't acked goes again, numbered from 0 in the
+ * order it was sent, and anything half reassembled from before is
+ * dropped.
+ */
+static void transport_reset(CnetAddr peer, int epoch)
+{
+    int renumber[TRANSPORT_SEGMENTS];
+    int flow;
+    int ii;
+    int jj;
+
+    printf("TRANSPORT: %d has rebooted, starting its connections again\n", peer);
+    for (ii = 0; ii < TRANSPORT_SEGMENTS; ii++)
+    {
+        Segment *s = &segments[ii];
+
+        renumber[ii] = 0;
+        for (jj = 0; s->used && s->dest == peer && jj < TRANSPORT_SEGMENTS; jj++)
+        {
+            if (segments[jj].used && segments[jj].dest == peer &&
+                segments[jj].flow == s->flow && segments[jj].tseq < s->tseq)
+            {
+                renumber[ii]++;
             }
-            else
+        }
+    }
+
+    tpEpoch[peer] = epoch;
+    for (flow = 0; flow < TRANSPORT_FLOWS; flow++)
+    {
+        tpExpected[peer][flow] = 0;
+        tpNakSent[peer][flow] = 0;
+        connection[peer][flow].nextSeq = connection[peer][flow].unacked;
+    }
+    for (ii = 0; ii < TRANSPORT_SEGMENTS; ii++)
+    {
+        if (segments[ii].used && segments[ii].dest == peer)
+        {
+            segments[ii].tseq = renumber[ii];
+            segments[ii].queued = 0;
+            segments[ii].resent = 1;
+            checkpoint_segment(&segments[ii]);
+        }
+    }
+    for (flow = 0; flow < TRANSPORT_FLOWS; flow++)
+    {
+        checkpoint_connection(peer, flow);
+    }
+
+    memset(mcastSeen[peer], 0, sizeof(mcastSeen[peer]));
+    mcastSeenNext[peer] = 0;
+    checkpoint_mcast(peer);
+    for (ii = 0; ii < REASSEMBLY_SLOTS; ii++)
+    {
+        if (reassembly[ii].used && reassembly[ii].src == peer &&
+            reassembly[ii].epoch < epoch)
+        {
+            reassembly[ii].used = 0;
+        }
+    }
+}
+
+/**
+ * Transport layer for receiver. messages are delivered in order,
+ * anything else is dropped and the ack says what we still need.
+ */
+static void transport_ready(CnetAddr src, int epoch, int flow, Segkind segment,
+                    int tseq, char *data, size_t len)
+{
+    PROF_FUNC();
+    int ii;
+
+    /* a later boot starts everything with src again, anything from an
+     * earlier one was numbered for connections that are gone */
+    if (epoch > tpEpoch[src])
+    {
+        transport_reset(src, epoch);
+    }
+    else if (epoch < tpEpoch[src])
+    {
+        printf("TRANSPORT: Message %d from %d is from before it rebooted, dropped\n",
+                tseq, src);
+        return;
+    }
+
+    if (segment == TP_MCAST)
+    {
+        /* nothing to put in order or ack, only copies to drop */
+        for (ii = 0; ii < MCAST_RECENT; ii++)
+        {
+            if (mcastSeen[src][ii] == tseq + 1)
             {
-                // we don't know what ACK number that is....
+                printf("TRANSPORT: Multicast %d from %d is a duplicate, dropped\n",
+                        tseq, src);
+                return;
             }
-        break;
+        }
+        mcastSeen[src][mcastSeenNext[src]] = tseq + 1;
+        mcastSeenNext[src] = (mcastSeenNext[src] + 1) % MCAST_RECENT;
+        checkpoint_mcast(src);
+        deliver(data, len);
+        return;
+    }
+    if (segment != TP_DATA)
+    {
+        transport_acked(src, flow, tseq);
 
-        /* we got data check if it was the expected seq number
-         * and send back an ACK if so.
-         * If it's not, ignore it and let the timeout occur.
-         */
-        case DL_DATA :
-            printf("\t\t\t\tDATA received, seq=%d on link %d\n", f.seq, link);
+        /* what followed tseq is getting there without the next
+         * one, don't wait for the timeout */
+        if (segment == TP_NAK && connection[src][flow].unacked > 0)
+        {
+            printf("TRANSPORT: NAK from %d, going back to message %d\n",
+                    src, tseq + 1);
+            transport_goback(src, flow);
+            transport_send();
+        }
+        return;
+    }
 
-            /*
-             * frame expected should be the last sequence number
-             * + 1 in the window for that link */
-            if (f.seq == nextReceive(link))
+    if (tseq == tpExpected[src][flow])
+    {
+        tpExpected[src][flow]++;
+        tpNakSent[src][flow] = 0;
+        checkpoint_connection(src, flow);
+        deliver(data, len);
+    }
+    else
+    {
+        printf("TRANSPORT: Message %d from %d is %s, dropped\n", tseq, src,
+                tseq < tpExpected[src][flow] ? "a duplicate" : "out of order");
+
+        /* only once per gap, the rest behind it is out of order too */
+        if (tseq > tpExpected[src][flow] && !tpNakSent[src][flow])
+        {
+            tpNakSent[src][flow] = 1;
+            transport_ack(src, flow, TP_NAK);
+            return;
+        }
+    }
+    transport_ack(src, flow, TP_ACK);
+}
+
+/*
+ * go back to the oldest message of any connection that has waited
+ * longer than its timeout for an ack.
+ */
+static void transport_timeout(CnetEvent ev, CnetTimerID timer, CnetData data)
+{
+    PROF_FUNC();
+    CHECKPOINT_EVENT();
+    int ii;
+    int jj;
+    int waiting = 0;
+
+    for (ii = 0; ii < TRANSPORT_SEGMENTS; ii++)
+    {
+        Segment *s = &segments[ii];
+        Connection *c = &connection[s->dest][s->flow];
+
+        if (!s->used)
+        {
+            continue;
+        }
+        waiting++;
+
+        /* only the oldest of a connection can time out */
+        if (!s->queued || nodeinfo.time_in_usec - s->sentAt < c->rto)
+        {
+            continue;
+        }
+        for (jj = 0; jj < TRANSPORT_SEGMENTS; jj++)
+        {
+            if (segments[jj].used && segments[jj].dest == s->dest &&
+                segments[jj].flow == s->flow && segments[jj].tseq < s->tseq)
             {
-                
-                // send ACK then push up network layer
-                //frameexpected[link] = 1 - frameexpected[link];
+                break;
+            }
+        }
+        if (jj < TRANSPORT_SEGMENTS)
+        {
+            continue;
+        }
+
+        printf("TRANSPORT: Timeout for message %d to %d, going back\n",
+                s->tseq, s->dest);
+        transport_goback(s->dest, s->flow);
+        c->rto = 2 * c->rto < TRANSPORT_MAX_RTO ? 2 * c->rto : TRANSPORT_MAX_RTO;
+        checkpoint_connection(s->dest, s->flow);
+    }
+
+    transport_send();
+
+    transportTimer = waiting > 0;
+    if (transportTimer)
+    {
+        CNET_start_timer(EV_TIMER7, TRANSPORT_TICK, 0);
+    }
+}
+
+
+/**
+ * Application Layer Sender
+ */
+static void application_down(CnetEvent ev, CnetTimerID timer, CnetData cdata)
+{
+    PROF_FUNC();
+    CHECKPOINT_EVENT();
+    CnetAddr dest;
+    size_t len = sizeof(char) * MAX_MESSAGE;
+    printf("DEBUG: Max size of message is %zu\n", len);
+
+
+    CHECK(CNET_read_application(&dest, message, &len));
+
+    printf("APPLICATION: Send msg size %zu to node #%d\n", len, dest);
+
+    //printCharArray(message, len);
+    /* cnet checks each pair of nodes gets its messages in order */
+    transport_down(dest, 0, message, len);
+}
+
+/*
+ * let the application send to every destination the transport
+ * has room for and hold it back from the rest.
+ */
+static void application_update(void)
+{
+    int dest;
+
+    if (trafficMode != TRAFFIC_CNET)
+    {
+        return;
+    }
+
+    for (dest = 0; dest < NUM_NODES; dest++)
+    {
+        if (dest == nodeinfo.nodenumber)
+        {
+            continue;
+        }
+        if (transport_room(dest, 0))
+        {
+            CNET_enable_application(dest);
+        }
+        else
+        {
+            CNET_disable_application(dest);
+        }
+    }
+}
+
+/*
+ * a link has drained some of its queue, more of a long message
+ * can go and then whatever the transport has waiting. messages
+ * cut up for links that are down may be going this way now.
+ */
+static void application_resume(int link)
+{
+    int other;
+
+    network_send(link);
+    for (other = 1; other <= nodeinfo.nlinks; other++)
+    {
+        if (other != link && linkDown[other - 1] && outgoing[other - 1].busy)
+        {
+            network_send(other);
+        }
+    }
+    transport_send();
+}
 
-                Frame ack;
-                ack.src_addr = nodeinfo.nodenumber;
-                ack.dest_addr = f.src_addr;
-                ack.seq = f.seq;
-                ack.kind = DL_ACK;
-                ack.len = 0;
+/*
+ * wait for the next record of a replayed or synthetic workload.
+ */
+static void startTraffic(void)
+{
+    if (traffic_next(&nextRecord))
+    {
+        CnetTime wait = nextRecord.time - nodeinfo.time_in_usec;
+        if (wait < 1)
+        {
+            wait = 1;
+        }
+        CNET_start_timer(EV_TIMER5, wait, 0);
+    }
+    else
+    {
+        printf("TRAFFIC: No more records for this node\n");
+    }
+}
+
+/**
+ * Application Layer Sender for replayed and synthetic traffic
+ */
+static void traffic_down(CnetEvent ev, CnetTimerID timer, CnetData cdata)
+{
+    PROF_FUNC();
+    CHECKPOINT_EVENT();
+    int link = routeLink(nodeinfo.nodenumber, nextRecord.dest, nextRecord.flow);
+    int multicast = nextRecord.group > 1;
+    Frame header;
+    int ii;
 
-                /* check if we need to add this to our buffer. */
-                /* or pass it along. */
-                if (f.dest_addr == nodeinfo.nodenumber)
-                {
-                    datalink_down(ack, DL_ACK, f.seq, link);
-                    nextToReceive[link - 1] = nextReceive(link);
-                    network_ready(f, f.len, link);
-                    printf("DATALINK: Passing packet up to network. size:%d\n", sizeof(Frame));
-                }
-                else
-                {
-                    int newLink = routingTable[nodeinfo.nodenumber][f.dest_addr];
-                    /* 
-                     * we will need to do some routing. 
-                     * work out if we have room for it
-                     */
-                    if (windowUsed[newLink] < windowSize)
-                    {
-                        /* we have room for it */
-                        window[newLink][windowUsed[newLink]] = f;
-                        windowUsed[newLink]++;
-                        /* increment the expected frame */
+    if (multicast)
+    {
+        memset(header.dests, 0, DEST_BYTES);
+        for (ii = 0; ii < nextRecord.group; ii++)
+        {
+            destAdd(&header, nextRecord.members[ii]);
+        }
+        header.dest_addr = nextRecord.dest;
+        header.flow = nextRecord.flow;
+    }
 
-                        // send the ack after the window has been filled
-                        datalink_down(ack, DL_ACK, f.seq, link);
+    /* the record is due but the transport is still holding all it
+     * can for that connection, or a multicast's links are still busy,
+     * try again once a frame has had time to leave */
+    if (multicast ? !multicastRoom(header) :
+        !transport_room(nextRecord.dest, nextRecord.flow))
+    {
+        /* no way there at all, look again when the links are checked */
+        CNET_start_timer(EV_TIMER5, link == 0 ? KEEPALIVE_TICK : WIRE_FRAME_MAX *
+                ((CnetTime)8000000 / linkinfo[link].bandwidth), 0);
+        return;
+    }
 
-                        /* send out the frame we added to the window */
-                        datalink_down(f, DL_DATA, expectedNextFrame(newLink), newLink);
-                        nextToReceive[link - 1] = nextReceive(link);
+    traffic_fill(&nextRecord, message);
 
-                        printf("DATALINK: Frame added to window, ack sent\n");
-                    }
-                    else
-                    {
-                        /* we don't have room for it */
-                        /* ignore it */
-                        printf("DATALINK: Window exhasted, ignore frame.\n");
-                    }
-                }
-            }
-            else
-            {
-                /* we didn't get the correct send an ACK of the last we
-                 * received TODO */
-                printf("Unexpected sequence number %d want %d\n", 
-                        f.seq, nextReceive(link));
-            }
-        break;
+    if (multicast)
+    {
+        printf("TRAFFIC: Multicast msg size %zu to %d nodes\n",
+                nextRecord.size, nextRecord.group);
+        transport_multicast(header, message, nextRecord.size);
+    }
+    else
+    {
+        printf("TRAFFIC: Send msg size %zu to node #%d\n", nextRecord.size, nextRecord.dest);
+        transport_down(nextRecord.dest, nextRecord.flow, message, nextRecord.size);
     }
+
+    startTraffic();
 }
 
 /**
- *  Physical Layer Receiver
+ * HELPER FUNCTIONS
  */
-static void physical_ready(CnetEvent ev, CnetTimerID timer, CnetData data)
+static void datalink_timeout(int link)
 {
-    int link;
-    Frame f;
-    size_t len;
+    PROF_FUNC();
+    timer[link - 1] = NULLTIMER;
+    if (linkDown[link - 1])
+    {
+        return;
+    }
+    if (windowUsed[link - 1] == 0)
+    {
+        /* the credit update must have been lost, try a frame */
+        printf("DATALINK: No credit on link %d, probing\n", link);
+        txCredit[link - 1] = 1;
+        datalink_send(link);
+        return;
+    }
+
+    /* the other end hasn't acked anything for too long */
+    if (++linkRetries[link - 1] >= LINK_RETRIES)
+    {
+        printf("DATALINK: %d timeouts in a row on link %d\n",
+                linkRetries[link - 1], link);
+        linkFailed(link);
+        return;
+    }
 
-    len = sizeof(Frame);
+    printf("timeout on link #%d, resending %d frames\n",
+            link, windowUsed[link - 1]);
+    resendWindow(link);
+}
 
-    CHECK(CNET_read_physical(&link, (Frame *)&f, &len));
+static void timeout1(CnetEvent ev, CnetTimerID timer, CnetData data)
+{
+    CHECKPOINT_EVENT();
+    datalink_timeout(1);
+}
 
-    printf("PHYSICAL: Just received a frame... %d\n", f.packetIndex);
-    printFrame(link, &f, len);
+static void timeout2(CnetEvent ev, CnetTimerID timer, CnetData data)
+{
+    CHECKPOINT_EVENT();
+    datalink_timeout(2);
+}
 
-    datalink_ready(link, f);
+/* only topologies with that many links have these timers */
+#if MAX_LINKS > 2
+static void timeout3(CnetEvent ev, CnetTimerID timer, CnetData data)
+{
+    CHECKPOINT_EVENT();
+    datalink_timeout(3);
 }
+#endif
 
-/**
- * physical layer sender
+#if MAX_LINKS > 3
+static void timeout4(CnetEvent ev, CnetTimerID timer, CnetData data)
+{
+    CHECKPOINT_EVENT();
+    datalink_timeout(4);
+}
+#endif
+
+/*
+ * how long a frame handed to the link now would wait before going
+ * out. everything written out or queued ahead of it has to go down
+ * the line first, and the queue only moves once the window has room,
+ * a window's worth each round trip.
  */
-static void physical_down(int link, Frame f)
+static CnetTime linkDelay(int link)
 {
-    size_t length = sizeof(Frame);
-    printf("PHYSICAL: Trying to transmit frame of size %d\n", length);
-    printFrame(link, &f, length);
-    CHECK(CNET_write_physical(link, (char *)&f, &length));
+    int queued = queue[link - 1][TC_ROUTING].used +
+        queue[link - 1][TC_INTERACTIVE].used + queue[link - 1][TC_BULK].used;
+    int ahead = queued + txQueue[link - 1][TX_DATA].used;
+    CnetTime rtt = linkSrtt[link - 1] > 0 ? linkSrtt[link - 1] :
+        2 * linkinfo[link].propagationdelay;
+    CnetTime delay = ahead * txTime(link, fragmentSize(link) + SIZE_OVERHEAD);
+
+    if (!bestEffort)
+    {
+        delay += queued * rtt / windowSize[link - 1];
+    }
+    return delay;
 }
 
-/**
- * Data link layer sender
+/*
+ * what sending to dest through a link costs now, the path beyond it
+ * and the wait on it and on the link our neighbour would go on by.
+ * -1 if the link is down or the neighbour is no closer to dest than
+ * we are, which keeps frames from looping.
  */
-static void datalink_down(Frame f, Framekind kind, 
-                    int seqno, int link)
+static long routeCost(CnetAddr dest, int link)
 {
-    // take the packet and generate a frame for it.
-    f.kind      = kind;
-    f.seq       = seqno;
-    f.checksum  = 0;
+    int me = nodeinfo.nodenumber;
+    int peer = linkPeer[me][link - 1];
+    int next = peer == dest ? 0 : nextHops[peer][dest][0].link;
+    long cost;
 
-    switch (kind) {
-        case DL_ACK :
-            printf("ACK transmitted, seq=%d\n", seqno);
-            f.src_addr = nodeinfo.nodenumber;
-            /* maybe remove this from last frame? */
+    if (linkDown[link - 1] || pathCost[peer][dest] >= pathCost[me][dest])
+    {
+        return -1;
+    }
+    cost = pathCost[me][peer] + pathCost[peer][dest] + linkDelay(link);
+    if (next != 0 && next <= MAX_LINKS)
+    {
+        cost += peerDelay[link - 1][next - 1];
+    }
+    return cost;
+}
 
-        break;
+/*
+ * choose the next hops towards every destination again. a link keeps
+ * its place while it costs no more than ROUTE_LEAVE percent of the
+ * best, and others join behind it in the order they are cheapest up
+ * to MAX_PATHS while they are within ROUTE_ENTER. flows only move when
+ * a route joins or leaves.
+ */
+static void routeUpdate(void)
+{
+    long cost[MAX_LINKS];
+    long best;
+    NextHop next[MAX_PATHS];
+    int used[MAX_LINKS];
+    int dest;
+    int link;
+    int pick;
+    int n;
+    int ii;
 
-        /**
-         * we are sending a new frame with data 
-         * check if we have room in our window
-         *      if so, add and reduce our size.
-         *
-         * If the window is exhasted we should close
-         * application for that link. TODO
-         */
-        case DL_DATA: {
-            CnetTime	timeout;
+    for (dest = 0; dest < NUM_NODES; dest++)
+    {
+        if (dest == nodeinfo.nodenumber)
+        {
+            continue;
+        }
+        best = -1;
+        for (link = 1; link <= nodeinfo.nlinks; link++)
+        {
+            cost[link - 1] = routeCost(dest, link);
+            used[link - 1] = 0;
+            if (cost[link - 1] >= 0 && (best < 0 || cost[link - 1] < best))
+            {
+                best = cost[link - 1];
+            }
+        }
+        if (best < 0)
+        {
+            continue;
+        }
 
-            /* the window is currently full, ignore the
-             * packet and let the sender resend later. */
-            if (windowUsed[link] >= windowSize)
+        n = 0;
+        for (ii = 0; ii < MAX_PATHS && routes[dest][ii].link != 0; ii++)
+        {
+            link = routes[dest][ii].link;
+            if (cost[link - 1] >= 0 && cost[link - 1] * 100 <= best * ROUTE_LEAVE)
             {
-                printf("DATA: No room in window for frame.\n");
-                /* ignore it */
-                return;
+                next[n].link = link;
+                next[n].cost = cost[link - 1];
+                used[link - 1] = 1;
+                n++;
             }
-            else
+        }
+        while (n < MAX_PATHS)
+        {
+            pick = 0;
+            for (link = 1; link <= nodeinfo.nlinks; link++)
+            {
+                if (!used[link - 1] && cost[link - 1] >= 0 &&
+                    cost[link - 1] * 100 <= best * ROUTE_ENTER &&
+                    (pick == 0 || cost[link - 1] < cost[pick - 1]))
+                {
+                    pick = link;
+                }
+            }
+            if (pick == 0)
             {
-                /* we have room inside out window. */
-                window[link - 1][windowUsed[link - 1]] = f;
-                windowUsed[link - 1]++;
-                printf("DATALINK DOWN: Old sequence # is %d\n", expectedFrame[link -1]);
-                expectedFrame[link - 1] = expectedNextFrame(link);
+                break;
             }
+            printf("NETWORK: Route to %d now also via link %d, cost %ld "
+                   "against %ld\n", dest, pick, cost[pick - 1], best);
+            next[n].link = pick;
+            next[n].cost = cost[pick - 1];
+            used[pick - 1] = 1;
+            n++;
+        }
+        for (ii = n; ii < MAX_PATHS; ii++)
+        {
+            next[ii].link = 0;
+            next[ii].cost = 0;
+        }
+        memcpy(routes[dest], next, sizeof(next));
+    }
+}
 
-            printf(" DATA transmitted, seq=%d\n", seqno);
-            printf("DATALINK DOWN: new sequence # is %d\n", expectedFrame[link -1]);
+/* has a link's wait moved by ROUTE_CHANGE and a quarter of itself */
+static int delayChanged(CnetTime was, CnetTime now)
+{
+    CnetTime diff = llabs(now - was);
 
-            /* how long should our timeout be */
-            timeout = FRAME_SIZE(f)*((CnetTime)8000000 / linkinfo[link].bandwidth) +
-                linkinfo[link].propagationdelay;
+    return diff >= ROUTE_CHANGE && diff * 4 >= (was > now ? was : now);
+}
 
-            /* store our last frame incase of timeouts */
-            lastFrame[link - 1] = f;
+/*
+ * look at how long our links would keep a frame waiting. if any has
+ * changed much since we told our neighbours, tell them
+ * again in a ROUTING HELLO and choose our own routes again. while
+ * any link has a wait we tell them every ROUTE_REFRESH anyway, in
+ * case one was lost, and a couple of times more once it has gone.
+ */
+static void routeTick(void)
+{
+    CnetTime now = nodeinfo.time_in_usec;
+    CnetTime delay[MAX_LINKS];
+    int changed = 0;
+    int waiting = 0;
+    Frame load;
+    Wire w;
+    int link;
 
-            restartTimer(link, timeout);
-            break;
-        }
+    if (now - routeChecked < ROUTE_TICK)
+    {
+        return;
     }
-    f.packetIndex = packetIndex;
-    packetIndex++;
+    routeChecked = now;
 
-    printf("DATALINK DOWN: frame size: %d of type: %d\n", sizeof(Frame), f.kind);
-    f.checksum  = CNET_ccitt((unsigned char *)&f, sizeof(Frame));
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        delay[link - 1] = linkDelay(link);
+        if (delayChanged(toldDelay[link - 1], delay[link - 1]))
+        {
+            changed = 1;
+        }
+        if (delay[link - 1] > 0)
+        {
+            waiting = 1;
+        }
+    }
+    if (changed)
+    {
+        routeUpdate();
+        routeRepeats = 0;
+    }
+    else if (!(now - routeTold >= ROUTE_REFRESH && (waiting || routeRepeats < 2)))
+    {
+        return;
+    }
+    routeRepeats++;
+    routeTold = now;
 
-    physical_down(link, f);
+    memset(&load, 0, sizeof(load));
+    load.src_addr = nodeinfo.nodenumber;
+    load.dest_addr = nodeinfo.nodenumber;
+    load.fclass = TC_ROUTING;
+    wire_init(&w, (unsigned char *)load.data, sizeof(load.data));
+    wire_putvar(&w, nodeinfo.nlinks);
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        wire_putvar(&w, delay[link - 1] / 1000);
+        toldDelay[link - 1] = delay[link - 1];
+    }
+    load.len = w.pos;
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        datalink_down(load, DL_HELLO, expectedFrame[link - 1], link);
+    }
 }
 
-/** 
- * Network layer Sender
- */
-static void network_down(Frame f)
+/* a neighbour has told us the wait on each of its links */
+static void routing_ready(int link, Frame f)
 {
-    // find which node to send it too.
-    int linkToUse = routingTable[nodeinfo.nodenumber][f.dest_addr];
+    CnetTime delay;
+    int changed = 0;
+    int n;
+    int ii;
+    Wire w;
 
-    /* encapsulate the message in a packet */
-    f.src_addr = nodeinfo.nodenumber;
-    printf("NETWORK: send packet on link %d for node %d\n", linkToUse, f.dest_addr);
-    //printf("\tnetwork had decided to use link %d to send to %d\n", linkToUse, p.dest_addr);
-    datalink_down(f, DL_DATA, expectedNextFrame(linkToUse), linkToUse);
-    nextframetosend[linkToUse] = 1 - nextframetosend[linkToUse];
+    wire_init(&w, (unsigned char *)f.data, f.len);
+    n = wire_getvar(&w);
+    for (ii = 0; ii < n && !w.bad; ii++)
+    {
+        delay = (CnetTime)wire_getvar(&w) * 1000;
+        if (ii < MAX_LINKS && !w.bad)
+        {
+            if (delayChanged(peerDelay[link - 1][ii], delay))
+            {
+                changed = 1;
+            }
+            peerDelay[link - 1][ii] = delay;
+        }
+    }
+    printf("NETWORK: Load from link %d for %d links\n", link, n);
+    if (changed)
+    {
+        routeUpdate();
+    }
 }
 
+/* how long a link can be left with nothing sent on it, about a
+ * round trip so a dead link is noticed in a few of them */
+static CnetTime keepaliveTime(int link)
+{
+    CnetTime idle = 2 * linkinfo[link].propagationdelay;
 
-/**
- * Application Layer Sender
+    return idle > KEEPALIVE_MIN ? idle : KEEPALIVE_MIN;
+}
+
+/*
+ * send a HELLO on every link that has been idle too long, links that
+ * are down included, and give up on any that we haven't heard from
+ * for several of them.
  */
-static void application_down(CnetEvent ev, CnetTimerID timer, CnetData cdata)
+static void keepalive(CnetEvent ev, CnetTimerID timer, CnetData data)
 {
-    Frame f;
-    f.len = sizeof(char) * MAX_MESSAGE;
-    printf("DEBUG: Max size of message is %d\n", (sizeof(char) * MAX_MESSAGE));
+    PROF_FUNC();
+    CHECKPOINT_EVENT();
+    CnetTime now = nodeinfo.time_in_usec;
+    Frame hello;
+    int link;
 
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        if (!linkDown[link - 1] && now - lastHeard[link - 1] >
+            LINK_MISSED * keepaliveTime(link) + 2 * linkinfo[link].propagationdelay)
+        {
+            printf("DATALINK: Nothing heard on link %d since %lld\n",
+                    link, (long long)lastHeard[link - 1]);
+            linkFailed(link);
+        }
 
-    CHECK(CNET_read_application(&f.dest_addr, (char *)&f.data, &f.len));
-    CNET_disable_application(f.dest_addr);
+        /* only with nothing in flight, the HELLO tells the other
+         * end that everything we sent has been acked */
+        if (windowUsed[link - 1] == 0 &&
+            now - lastSent[link - 1] >= keepaliveTime(link))
+        {
+            hello.src_addr = nodeinfo.nodenumber;
+            hello.dest_addr = nodeinfo.nodenumber;
+            hello.fclass = TC_CONTROL;
+            hello.len = 0;
+            datalink_down(hello, DL_HELLO, expectedFrame[link - 1], link);
+        }
+    }
+    routeTick();
+    CNET_start_timer(EV_TIMER8, KEEPALIVE_TICK, 0);
+}
 
-    printf("APPLICATION: Send msg size %d to node #%d\n", f.len, f.dest_addr);
+/* how much of each link's bandwidth we have used so far */
+static void showlinks(void)
+{
+    int link;
+    double seconds = nodeinfo.time_in_usec / 1000000.0;
 
-    //printCharArray(f.data, f.len);
-    network_down(f);
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        printf("link %d: sent %ld frames %ld bytes, %.1f%% utilised, "
+               "resent %ld, received %ld corrupt, frames of %d bytes\n",
+                link, linkFrames[link - 1], linkBytes[link - 1],
+                seconds > 0 ? 100.0 * linkBytes[link - 1] * 8 /
+                    (linkinfo[link].bandwidth * seconds) : 0.0,
+                linkResent[link - 1], linkCorrupt[link - 1],
+                (int)fragmentSize(link));
+    }
 }
 
-/**
- * HELPER FUNCTIONS
- */
-static void timeout1(CnetEvent ev, CnetTimerID timer, CnetData data)
+/* how the frame buffers are shared out and the most each link used */
+static void showpool(void)
 {
-    printf("timeout on link #1\n");
-    datalink_down(window[0][0], DL_DATA, lastFrame[0].seq, 1);
+    int link;
+
+    printf("pool: %d frames, %d in use, at most %d\n",
+            poolSize, poolSize - poolFreeCount, poolPeakAll);
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        printf("link %d: %d frames in use, at most %d, reserve %d cap %d\n",
+                link, poolUsed[link - 1], poolPeak[link - 1],
+                poolReserve[link - 1], poolCap[link - 1]);
+    }
 }
 
-static void timeout2(CnetEvent ev, CnetTimerID timer, CnetData data)
+static void showstate(CnetEvent ev, CnetTimerID timer, CnetData data)
 {
-    printf("timeout on link #2\n");
-    datalink_down(window[1][0], DL_DATA, lastFrame[1].seq, 2);
+    int link;
+
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        printf("link %d%s: window %d/%d credit %d/%d queued control %d "
+               "routing %d interactive %d bulk %d\n", link,
+                linkDown[link - 1] ? " (down)" : "",
+                windowUsed[link - 1], windowSize[link - 1],
+                txCredit[link - 1], rxAdvertised[link - 1],
+                queue[link - 1][TC_CONTROL].used,
+                queue[link - 1][TC_ROUTING].used,
+                queue[link - 1][TC_INTERACTIVE].used,
+                queue[link - 1][TC_BULK].used);
+    }
+    showlinks();
+    showpool();
+    prof_report();
 }
 
-static void timeout3(CnetEvent ev, CnetTimerID timer, CnetData data)
+static void shutdown_node(CnetEvent ev, CnetTimerID timer, CnetData data)
 {
-    printf("timeout on link #3\n");
-    datalink_down(window[2][0], DL_DATA, lastFrame[2].seq, 3);
+    showlinks();
+    showpool();
+    prof_report();
+    impair_report();
+    traffic_report();
 }
 
-static void timeout4(CnetEvent ev, CnetTimerID timer, CnetData data)
+/*
+ * map this node's checkpoint file, if CHECKPOINT names a directory.
+ * returns 1 if it holds where we were before a reboot. a run starts
+ * afresh whatever the file has in it.
+ */
+static int checkpoint_open(void)
 {
-    printf("timeout on link #4\n");
-    datalink_down(window[3][0], DL_DATA, lastFrame[3].seq, 4);
+    const char *dir = getenv("CHECKPOINT");
+    char path[256];
+    void *map;
+    int fd;
+
+    if (dir == NULL || dir[0] == '\0')
+    {
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.ckpt", dir, nodeinfo.nodename);
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(Checkpoint)) != 0)
+    {
+        printf("CHECKPOINT: Can't open %s\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return 0;
+    }
+    map = mmap(NULL, sizeof(Checkpoint), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("CHECKPOINT: Can't map %s\n", path);
+        return 0;
+    }
+    checkpoint = map;
+
+    if (nodeinfo.time_in_usec > 0 && checkpoint->magic == CHECKPOINT_MAGIC &&
+        checkpoint->size == sizeof(Checkpoint) &&
+        checkpoint->node == nodeinfo.nodenumber &&
+        memcmp(checkpoint->windowSize, windowSize, sizeof(windowSize)) == 0)
+    {
+        return 1;
+    }
+
+    /* a fresh start, everything after this is written as it changes */
+    memset(checkpoint, 0, sizeof(Checkpoint));
+    checkpoint->magic = CHECKPOINT_MAGIC;
+    checkpoint->size = sizeof(Checkpoint);
+    checkpoint->node = nodeinfo.nodenumber;
+    memcpy(checkpoint->windowSize, windowSize, sizeof(windowSize));
+    memcpy(checkpoint->connection, connection, sizeof(connection));
+    checkpoint->bootEpoch = bootEpoch;
+    return 0;
 }
 
-static void showstate(CnetEvent ev, CnetTimerID timer, CnetData data)
+/*
+ * carry on from the checkpoint after a reboot. the windows come back
+ * as they were and the transport keeps its messages and sequence
+ * numbers. frames that were only queued are lost, so every message
+ * still waiting for an ack goes again.
+ */
+static void checkpoint_restore(void)
+{
+    int link;
+    int ii;
+    int seq;
+    Frame *b;
+
+    memcpy(windowUsed, checkpoint->windowUsed, sizeof(windowUsed));
+    memcpy(expectedFrame, checkpoint->expectedFrame, sizeof(expectedFrame));
+    memcpy(nextToReceive, checkpoint->nextToReceive, sizeof(nextToReceive));
+    memcpy(txCredit, checkpoint->txCredit, sizeof(txCredit));
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        /* the window ends with the last frame we sent */
+        for (ii = 0; ii < windowUsed[link - 1]; ii++)
+        {
+            seq = (expectedFrame[link - 1] - windowUsed[link - 1] + 1 + ii +
+                    windowSize[link - 1] + 1) % (windowSize[link - 1] + 1);
+            b = poolGet(link);
+            *b = checkpoint->window[link - 1][seq];
+            window[link - 1][ii] = b;
+        }
+    }
+
+    messageId = checkpoint->messageId;
+    mcastNextSeq = checkpoint->mcastNextSeq;
+    bootEpoch = checkpoint->bootEpoch;
+    memcpy(tpEpoch, checkpoint->tpEpoch, sizeof(tpEpoch));
+    memcpy(segments, checkpoint->segments, sizeof(segments));
+    memcpy(connection, checkpoint->connection, sizeof(connection));
+    memcpy(tpExpected, checkpoint->tpExpected, sizeof(tpExpected));
+    memcpy(mcastSeen, checkpoint->mcastSeen, sizeof(mcastSeen));
+    memcpy(mcastSeenNext, checkpoint->mcastSeenNext, sizeof(mcastSeenNext));
+    for (ii = 0; ii < TRANSPORT_SEGMENTS; ii++)
+    {
+        if (segments[ii].used)
+        {
+            segments[ii].queued = 0;
+            segments[ii].resent = 1;
+            transportTimer = 1;
+        }
+    }
+    if (transportTimer)
+    {
+        CNET_start_timer(EV_TIMER7, TRANSPORT_TICK, 0);
+    }
+}
+
+/*
+ * tell each neighbour where we are after a warm restart. a NAK acks
+ * what we had taken from it and has it go back over the rest of its
+ * window, while we go back over ours, so both are moving again within
+ * a round trip.
+ */
+static void checkpoint_resync(void)
 {
-    /*printf(
-    "\n\tackexpected\t= %d\n\tnextframetosend\t= %d\n\tframeexpected\t= %d\n",
-		    ackexpected, nextframetosend, frameexpected);*/
+    Frame nak;
+    int link;
+
+    memset(&nak, 0, sizeof(nak));
+    for (link = 1; link <= nodeinfo.nlinks; link++)
+    {
+        printf("CHECKPOINT: Resuming link %d, %d frames from seq %d, "
+               "received to %d\n", link, windowUsed[link - 1],
+                windowUsed[link - 1] > 0 ? window[link - 1][0]->seq : -1,
+                nextToReceive[link - 1]);
+        if (!bestEffort)
+        {
+            datalink_down(nak, DL_NAK, nextToReceive[link - 1], link);
+        }
+        if (windowUsed[link - 1] > 0)
+        {
+            resendWindow(link);
+        }
+    }
+    transport_send();
 }
 
 void reboot_node(CnetEvent ev, CnetTimerID timer, CnetData data)
@@ -545,30 +4099,82 @@ void reboot_node(CnetEvent ev, CnetTimerID timer, CnetData data)
 
     CHECK(CNET_set_handler( EV_TIMER1,           timeout1, 0));
     CHECK(CNET_set_handler( EV_TIMER2,           timeout2, 0));
+#if MAX_LINKS > 2
     CHECK(CNET_set_handler( EV_TIMER3,           timeout3, 0));
+#endif
+#if MAX_LINKS > 3
     CHECK(CNET_set_handler( EV_TIMER4,           timeout4, 0));
+#endif
+    CHECK(CNET_set_handler( EV_TIMER5,           traffic_down, 0));
+    CHECK(CNET_set_handler( EV_TIMER6,           reassembly_timeout, 0));
+    CHECK(CNET_set_handler( EV_TIMER7,           transport_timeout, 0));
+    CHECK(CNET_set_handler( EV_TIMER8,           keepalive, 0));
+    CHECK(CNET_set_handler( EV_TIMER9,           physical_timeout, 0));
+    CHECK(CNET_set_handler( EV_TIMER10,          delay_timeout, 0));
+    CHECK(CNET_set_handler( EV_SHUTDOWN,         shutdown_node, 0));
 
     CHECK(CNET_set_handler( EV_DEBUG0,           showstate, 0));
 
     CHECK(CNET_set_debug_string( EV_DEBUG0, "State"));
 
-    if (nodeinfo.nodenumber == 0 || nodeinfo.nodenumber == 1)
+    int ii;
+    for (ii = 0; ii < MAX_LINKS; ii++)
     {
-        windowSize = MAX_WINDOW;
+        windowSize[ii] = linkWindow[nodeinfo.nodenumber][ii];
+        windowUsed[ii] = 0;
+        txCredit[ii] = windowSize[ii];
+        rxAdvertised[ii] = windowSize[ii];
+        drrClass[ii] = TC_INTERACTIVE;
+        drrFresh[ii] = 1;
+        ackPending[ii] = 0;
+        ackTimer[ii] = NULLTIMER;
     }
-    else
+    for (ii = 0; ii < nodeinfo.nlinks; ii++)
     {
-        windowSize = MAX_WINDOW / 2;
+        sizeLevel[ii] = sizeTop(ii + 1);
+        memset(sizeHeardSeen[ii], -1, sizeof(sizeHeardSeen[ii]));
     }
+    memcpy(routes, nextHops[nodeinfo.nodenumber], sizeof(routes));
+    poolInit();
+    physical_init();
 
+    /* rounded up, so only the first boot is 0 */
+    bootEpoch = (nodeinfo.time_in_usec + 999999) / 1000000;
 
-    int ii;
-    for (ii = 0; ii < windowSize; ii++)
+    bestEffort = getenv("DATALINK") != NULL &&
+        strcmp(getenv("DATALINK"), "besteffort") == 0;
+    impair_init();
+    heldCount = 0;
+
+    for (ii = 0; ii < NUM_NODES * TRANSPORT_FLOWS; ii++)
     {
-        windowUsed[ii] = 0;
+        connection[ii / TRANSPORT_FLOWS][ii % TRANSPORT_FLOWS].rto =
+            bestEffort ? TRANSPORT_RTO : TRANSPORT_RELIABLE_RTO;
+    }
+
+    if (checkpoint_open())
+    {
+        printf("CHECKPOINT: Warm restart at %lld\n",
+                (long long)nodeinfo.time_in_usec);
+        checkpoint_restore();
+        for (ii = 0; ii < MAX_LINKS; ii++)
+        {
+            lastHeard[ii] = nodeinfo.time_in_usec;
+        }
+        checkpoint_resync();
     }
 
-    CNET_enable_application(ALLNODES);
+    CNET_start_timer(EV_TIMER8, KEEPALIVE_TICK, 0);
+
+    trafficMode = traffic_init(NUM_NODES, MAX_MESSAGE);
+    if (trafficMode == TRAFFIC_CNET)
+    {
+        CNET_enable_application(ALLNODES);
+    }
+    else
+    {
+        startTraffic();
+    }
 }
 
 
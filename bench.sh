@@ -0,0 +1,106 @@
+#!/bin/sh
+#
+# bench.sh - how the protocol scales with the size of the network
+#
+# For each kind of graph and node count netgen writes a topology to
+# bench/KIND-N, topogen its header to topo/KIND-N/topology.h, and cnet
+# runs it for a while of simulated time. One line is printed a run:
+#
+#     kind, nodes, links    the graph
+#     text, static          bytes of code and tables shared by all nodes,
+#                           and of globals each node has its own copy of
+#     events, delivered     from cnet's statistics
+#     goodput               delivered bytes a simulated second
+#     events/s              events a second of wall clock time
+#
+# A step that fails is printed in place of the numbers and the larger
+# sizes of that kind are skipped.
+#
+#     ./bench.sh [-e seconds] [-k "ring tree ..."] [-n "10 100 ..."]
+#
+# CNET is the simulator to run (cnet), CNETINC the directory holding
+# cnet.h for compiling the protocol to measure it, and TOPOGEN any
+# options for topogen.
+
+seconds=300
+kinds="ring tree mesh geometric scalefree"
+sizes="10 100 1000 10000"
+cnet=${CNET:-cnet}
+cnetinc=${CNETINC:-/usr/local/lib}
+
+while [ $# -gt 1 ]
+do
+    case "$1" in
+        -e) seconds=$2 ;;
+        -k) kinds=$2 ;;
+        -n) sizes=$2 ;;
+        *)  break ;;
+    esac
+    shift 2
+done
+if [ $# -ne 0 ]
+then
+    echo "usage: bench.sh [-e seconds] [-k kinds] [-n sizes]" >&2
+    exit 1
+fi
+
+make -s netgen topogen || exit 1
+mkdir -p bench
+tmp=${TMPDIR:-/tmp}/bench.$$
+trap 'rm -f $tmp.*' EXIT
+
+printf "%-10s %6s %6s %10s %10s %10s %10s %10s %10s\n" \
+    kind nodes links text static events delivered goodput events/s
+
+for kind in $kinds
+do
+    for n in $sizes
+    do
+        name=$kind-$n
+        printf "%-10s %6s " $kind $n
+
+        if ! ./netgen -n $n $kind > bench/$name 2> $tmp.err
+        then
+            head -1 $tmp.err
+            break
+        fi
+        links=$(grep -c "link to" bench/$name)
+        printf "%6s " $links
+
+        mkdir -p topo/$name
+        if ! ./topogen $TOPOGEN bench/$name > topo/$name/topology.h 2> $tmp.err
+        then
+            head -1 $tmp.err
+            break
+        fi
+
+        # code and tables are shared, data and bss are per node
+        if ! cc -c -w -I$cnetinc -Itopo/$name assignment.c -o $tmp.a.o 2> $tmp.err ||
+           ! cc -c -w -I$cnetinc -Itopo/$name traffic.c -o $tmp.t.o 2>> $tmp.err ||
+           ! cc -c -w -I$cnetinc -Itopo/$name impair.c -o $tmp.i.o 2>> $tmp.err
+        then
+            echo "compile: $(grep -m1 error $tmp.err)"
+            break
+        fi
+        size $tmp.a.o $tmp.t.o $tmp.i.o | awk 'NR > 1 { t += $1; s += $2 + $3 }
+            END { printf "%10d %10d ", t, s }'
+
+        start=$(date +%s.%N)
+        if ! $cnet -W -q -e ${seconds}s -s bench/$name > $tmp.out 2>&1
+        then
+            echo "cnet: $(tail -1 $tmp.out)"
+            break
+        fi
+        end=$(date +%s.%N)
+
+        awk -v start=$start -v end=$end -F: '
+            /Events raised/         { events = $2 + 0 }
+            /Messages delivered/    { delivered = $2 + 0 }
+            /Message bandwidth/     { bandwidth = $2 + 0 }
+            END {
+                wall = end - start
+                printf "%10d %10d %10d %10d\n", events, delivered,
+                    bandwidth / 8, (wall > 0 ? events / wall : 0)
+            }' $tmp.out
+    done
+done
@@ -0,0 +1,191 @@
+#include <cnet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "impair.h"
+#include "traffic.h"
+
+/*
+ * The faults IMPAIR asks for, drawn for each frame a node reads off its
+ * links. Every link has its own random stream so one link's traffic
+ * doesn't move another's faults, see impair.h.
+ */
+
+typedef struct {
+    double      loss;           /* good to bad */
+    double      burst;          /* mean frames in the bad state */
+    double      badLoss;
+    double      goodLoss;
+    double      reorder;
+    CnetTime    spread;
+    double      dup;
+    CnetTime    outageStart[IMPAIR_OUTAGES];
+    CnetTime    outageLen[IMPAIR_OUTAGES];
+    int         outages;
+    CnetTime    every;
+    int         link;           /* 0 for all */
+    int         node;           /* -1 for all */
+} ImpairModel;
+
+static ImpairModel impair;
+static int impairOn;
+static unsigned long long impairRng[IMPAIR_LINKS + 1];
+static int impairBad[IMPAIR_LINKS + 1];
+static long impairCount[IMPAIR_LINKS + 1][IMPAIR_DELAY + 1];
+
+int impair_init(void)
+{
+    const char *env = getenv("IMPAIR");
+    char spec[512];
+    char *word;
+    unsigned long long seed = 1;
+    int ii;
+
+    memset(&impair, 0, sizeof(impair));
+    impair.burst = 1;
+    impair.badLoss = 1;
+    impair.spread = 100000;
+    impair.node = -1;
+    impairOn = 0;
+
+    if (env == NULL || env[0] == '\0')
+    {
+        return 0;
+    }
+
+    strncpy(spec, env, sizeof(spec) - 1);
+    spec[sizeof(spec) - 1] = '\0';
+
+    for (word = strtok(spec, " ,"); word != NULL; word = strtok(NULL, " ,"))
+    {
+        char *value = strchr(word, '=');
+
+        if (value == NULL)
+        {
+            printf("PHYSICAL: unknown IMPAIR option %s\n", word);
+            continue;
+        }
+
+        *value++ = '\0';
+        if (strcmp(word, "seed") == 0)             seed = strtoull(value, NULL, 10);
+        else if (strcmp(word, "loss") == 0)        impair.loss = atof(value);
+        else if (strcmp(word, "burst") == 0)       impair.burst = atof(value);
+        else if (strcmp(word, "badloss") == 0)     impair.badLoss = atof(value);
+        else if (strcmp(word, "goodloss") == 0)    impair.goodLoss = atof(value);
+        else if (strcmp(word, "reorder") == 0)     impair.reorder = atof(value);
+        else if (strcmp(word, "spread") == 0)      impair.spread = traffic_time(value);
+        else if (strcmp(word, "dup") == 0)         impair.dup = atof(value);
+        else if (strcmp(word, "every") == 0)       impair.every = traffic_time(value);
+        else if (strcmp(word, "link") == 0)        impair.link = atoi(value);
+        else if (strcmp(word, "node") == 0)        impair.node = atoi(value);
+        else if (strcmp(word, "outage") == 0 && impair.outages < IMPAIR_OUTAGES &&
+                 strchr(value, ':') != NULL)
+        {
+            impair.outageStart[impair.outages] = traffic_time(value);
+            impair.outageLen[impair.outages] = traffic_time(strchr(value, ':') + 1);
+            impair.outages++;
+        }
+        else printf("PHYSICAL: unknown IMPAIR option %s\n", word);
+    }
+
+    if (impair.burst < 1)
+    {
+        impair.burst = 1;
+    }
+    if (impair.spread < 1)
+    {
+        impair.spread = 1;
+    }
+
+    for (ii = 0; ii <= IMPAIR_LINKS; ii++)
+    {
+        impairRng[ii] = (seed * 0x9E3779B97F4A7C15ULL + nodeinfo.nodenumber + 1) *
+            (2 * ii + 1) + ii;
+        impairBad[ii] = 0;
+    }
+    memset(impairCount, 0, sizeof(impairCount));
+
+    impairOn = impair.node < 0 || impair.node == nodeinfo.nodenumber;
+    if (impairOn)
+    {
+        printf("PHYSICAL: impairing seed %llu loss %g burst %g reorder %g "
+                "dup %g outages %d\n", seed, impair.loss, impair.burst,
+                impair.reorder, impair.dup, impair.outages);
+    }
+    return impairOn;
+}
+
+static int impair_outage(CnetTime now)
+{
+    int ii;
+
+    if (impair.every > 0)
+    {
+        now %= impair.every;
+    }
+    for (ii = 0; ii < impair.outages; ii++)
+    {
+        if (now >= impair.outageStart[ii] &&
+            now < impair.outageStart[ii] + impair.outageLen[ii])
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+ImpairAction impair_frame(int link, CnetTime now, CnetTime *delay)
+{
+    ImpairAction action = IMPAIR_PASS;
+    int l = link < IMPAIR_LINKS ? link : IMPAIR_LINKS;
+    unsigned long long *r = &impairRng[l];
+
+    if (!impairOn || (impair.link != 0 && impair.link != link))
+    {
+        return IMPAIR_PASS;
+    }
+
+    if (impairBad[l])
+    {
+        impairBad[l] = traffic_uniform(r) >= 1 / impair.burst;
+    }
+    else
+    {
+        impairBad[l] = traffic_uniform(r) < impair.loss;
+    }
+
+    if (traffic_uniform(r) < (impairBad[l] ? impair.badLoss : impair.goodLoss) ||
+        impair_outage(now))
+    {
+        action = IMPAIR_LOSE;
+    }
+    else if (traffic_uniform(r) < impair.reorder)
+    {
+        *delay = 1 + (CnetTime)(traffic_uniform(r) * impair.spread);
+        action = IMPAIR_DELAY;
+    }
+    else if (traffic_uniform(r) < impair.dup)
+    {
+        action = IMPAIR_DUPLICATE;
+    }
+    impairCount[l][action]++;
+    return action;
+}
+
+void impair_report(void)
+{
+    int ii;
+
+    if (!impairOn)
+    {
+        return;
+    }
+    for (ii = 1; ii <= IMPAIR_LINKS && ii <= nodeinfo.nlinks; ii++)
+    {
+        printf("PHYSICAL: link %d impaired %ld passed, %ld lost, "
+                "%ld duplicated, %ld delayed\n", ii,
+                impairCount[ii][IMPAIR_PASS], impairCount[ii][IMPAIR_LOSE],
+                impairCount[ii][IMPAIR_DUPLICATE],
+                impairCount[ii][IMPAIR_DELAY]);
+    }
+}
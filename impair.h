@@ -0,0 +1,57 @@
+#ifndef IMPAIR_H
+#define IMPAIR_H
+
+/*
+ * Faults injected into frames as they come off a link, between the
+ * sender's CNET_write_physical() and the receiver's physical_ready(), so
+ * the ARQ can be measured against more than cnet's own independent
+ * losses. Nothing is done unless the IMPAIR environment variable is set,
+ * e.g.
+ *
+ *     IMPAIR="loss=0.01 burst=8 seed=3"
+ *     IMPAIR="reorder=0.1 spread=200ms"
+ *     IMPAIR="dup=0.05"
+ *     IMPAIR="outage=60s:10s every=120s link=1"
+ *
+ * The models can be combined and are applied in that order:
+ *
+ *     loss, burst       Gilbert-Elliott. Each frame the link goes from
+ *     badloss, goodloss good to bad with odds loss, and back with odds
+ *                       1/burst, so bursts last burst frames on average.
+ *                       A frame is lost with odds badloss (1) in the
+ *                       bad state and goodloss (0) in the good one.
+ *     reorder, spread   hold a frame back for up to spread (100ms), so
+ *                       the ones behind it overtake it
+ *     dup               deliver a frame twice
+ *     outage, every     lose everything from START for LEN, up to
+ *                       IMPAIR_OUTAGES of them, repeating every period
+ *
+ * link=N and node=N only impair frames arriving on that link or node.
+ * Each link draws from its own stream, seeded from seed, the node and
+ * the link, so the same run gives the same faults.
+ */
+
+#include <cnet.h>
+
+#define IMPAIR_LINKS    32
+#define IMPAIR_OUTAGES  8
+
+typedef enum { IMPAIR_PASS, IMPAIR_LOSE, IMPAIR_DUPLICATE,
+               IMPAIR_DELAY } ImpairAction;
+
+/**
+ * Read the IMPAIR environment variable. Returns 1 when frames arriving
+ * at this node are to be impaired.
+ */
+int impair_init(void);
+
+/**
+ * What happens to a frame arriving on link at time now. For
+ * IMPAIR_DELAY, *delay is how long to hold it.
+ */
+ImpairAction impair_frame(int link, CnetTime now, CnetTime *delay);
+
+/* what was done to each link, at shutdown */
+void impair_report(void);
+
+#endif
@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# loadcheck.sh - does every node still get its traffic through under load
+#
+# Runs one topology with every node sending as fast as TRAFFIC's poisson
+# generator is told to, and prints what each node sent and delivered,
+# from the TRAFFIC lines it writes on shutdown:
+#
+#     node                  the node's name
+#     sent, delivered       messages it originated and took in
+#
+# A node that sends or delivers less than a quarter of the average is
+# marked STARVED and the script exits 1. Nodes starved of credit behind
+# a busy link show up here long before they lower the network's total.
+#
+#     ./loadcheck.sh [-e seconds] [-t "poisson rate=300ms ..."] [-r seed]
+#                    [TOPOLOGY]
+#
+# CNET is the simulator to run (cnet).
+
+seconds=600
+traffic="poisson rate=300ms seed=7 flows=4"
+seed=1
+cnet=${CNET:-cnet}
+
+while [ $# -gt 1 ]
+do
+    case "$1" in
+        -e) seconds=$2 ;;
+        -t) traffic=$2 ;;
+        -r) seed=$2 ;;
+        *)  break ;;
+    esac
+    shift 2
+done
+topology=${1:-ASSIGNMENT}
+if [ $# -gt 1 ] || [ ! -f "$topology" ]
+then
+    echo "usage: loadcheck.sh [-e seconds] [-t traffic] [-r seed]" \
+        "[TOPOLOGY]" >&2
+    exit 1
+fi
+
+tmp=${TMPDIR:-/tmp}/loadcheck.$$
+trap 'rm -f $tmp.*' EXIT
+
+# each node's output is copied to $tmp.out.<node>
+if ! TRAFFIC="$traffic" \
+    $cnet -W -q -S $seed -e ${seconds}s -o $tmp.out $topology > $tmp.log 2>&1
+then
+    echo "cnet: $(tail -1 $tmp.log)"
+    exit 1
+fi
+
+for f in $tmp.out.*
+do
+    awk -v node=${f#$tmp.out.} '
+        /^TRAFFIC: sent/      { sent = $3 }
+        /^TRAFFIC: delivered/ { delivered = $3 }
+        END { print node, sent + 0, delivered + 0 }' $f
+done | awk '
+    { node[NR] = $1; sent[NR] = $2; delivered[NR] = $3
+      sentAll += $2; deliveredAll += $3 }
+    END {
+        if (NR == 0)
+        {
+            print "no TRAFFIC report from any node"
+            exit 1
+        }
+        printf "%-12s %10s %10s\n", "node", "sent", "delivered"
+        for (ii = 1; ii <= NR; ii++)
+        {
+            low = sent[ii] * 4 * NR < sentAll ||
+                  delivered[ii] * 4 * NR < deliveredAll
+            printf "%-12s %10d %10d%s\n", node[ii], sent[ii],
+                delivered[ii], low ? "  STARVED" : ""
+            starved += low
+        }
+        exit starved > 0
+    }'
@@ -0,0 +1,424 @@
+/*
+ * netgen - write a synthetic cnet topology file
+ *
+ * Builds a graph of the given kind and size and writes it out as a cnet
+ * topology file like ASSIGNMENT and TEST, for topogen and cnet to read.
+ *
+ *     ./netgen [-n nodes] [-d maxdegree] [-r seed] [-t name] KIND
+ *
+ * KIND is one of
+ *
+ *     ring        each node linked to the next, the last back to the first
+ *     tree        a binary tree, node i under node (i - 1) / 2
+ *     mesh        a square grid, each node linked right and down
+ *     geometric   nodes scattered at random, linked to those close by
+ *     scalefree   nodes joining one at a time, each linking to two others
+ *                 picked in proportion to the links they already have
+ *
+ * Every node is placed on a 1000 x 1000 field. A link's propagation delay
+ * comes from the distance it covers, 1ms plus 1ms every 100 units, and its
+ * bandwidth is picked at random from 56Kbps up to 2Mbps. No node gets
+ * more than maxdegree links (4 by default, the most assignment.c takes),
+ * which caps the hubs of a scale free graph. The compile line points at
+ * topo/NAME/topology.h, NAME being -t or KIND-NODES.
+ *
+ * The file is written to stdout. Nodes are named n0, n1, ... and each
+ * link is declared by the later of its two nodes, so cnet and topogen
+ * number the nodes in name order.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MAX_NODES       10000
+#define MAX_DEGREE      64
+#define FIELD           1000
+#define PI              3.14159265358979323846
+
+/* links between nodes scattered at random, to about this many each */
+#define GEOMETRIC_DEGREE 3
+
+typedef struct {
+    double  x, y;
+    int     nlinks;
+    int     peers[MAX_DEGREE];
+} Node;
+
+static Node nodes[MAX_NODES];
+static int nnodes = 10;
+static int maxDegree = 4;
+static unsigned long long rng = 1;
+
+static const char *bandwidths[] = { "56Kbps", "128Kbps", "512Kbps", "2Mbps" };
+
+/* xorshift64*, so a seed gives the same graph everywhere */
+static unsigned long long nextRandom(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 2685821657736338717ULL;
+}
+
+/* uniform in [0, 1) */
+static double uniform(void)
+{
+    return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double distance(int a, int b)
+{
+    double dx = nodes[a].x - nodes[b].x;
+    double dy = nodes[a].y - nodes[b].y;
+
+    return sqrt(dx * dx + dy * dy);
+}
+
+static int linked(int a, int b)
+{
+    int ii;
+
+    for (ii = 0; ii < nodes[a].nlinks; ii++)
+    {
+        if (nodes[a].peers[ii] == b)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int hasRoom(int a)
+{
+    return nodes[a].nlinks < maxDegree;
+}
+
+/* link a and b unless they already are or either is full, 1 if done */
+static int addLink(int a, int b)
+{
+    if (a == b || linked(a, b) || !hasRoom(a) || !hasRoom(b))
+    {
+        return 0;
+    }
+    nodes[a].peers[nodes[a].nlinks++] = b;
+    nodes[b].peers[nodes[b].nlinks++] = a;
+    return 1;
+}
+
+static void ring(void)
+{
+    int ii;
+
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        double angle = 2 * PI * ii / nnodes;
+
+        nodes[ii].x = FIELD / 2 + FIELD / 2 * cos(angle);
+        nodes[ii].y = FIELD / 2 + FIELD / 2 * sin(angle);
+    }
+    for (ii = 1; ii < nnodes; ii++)
+    {
+        addLink(ii - 1, ii);
+    }
+    if (nnodes > 2)
+    {
+        addLink(nnodes - 1, 0);
+    }
+}
+
+static void tree(void)
+{
+    int depth = 0;
+    int ii;
+
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        int first;
+        int width;
+
+        while ((2 << depth) - 1 <= ii)
+        {
+            depth++;
+        }
+        first = (1 << depth) - 1;
+        width = 1 << depth;
+        nodes[ii].x = FIELD * (ii - first + 0.5) / width;
+        nodes[ii].y = FIELD * (depth + 0.5) / (log2(nnodes) + 1);
+        if (ii > 0)
+        {
+            addLink((ii - 1) / 2, ii);
+        }
+    }
+}
+
+static void mesh(void)
+{
+    int side = (int)ceil(sqrt(nnodes));
+    int ii;
+
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        nodes[ii].x = FIELD * (ii % side + 0.5) / side;
+        nodes[ii].y = FIELD * (ii / side + 0.5) / side;
+        if (ii % side > 0)
+        {
+            addLink(ii - 1, ii);
+        }
+        if (ii >= side)
+        {
+            addLink(ii - side, ii);
+        }
+    }
+}
+
+/*
+ * scatter the nodes, join them all with the shortest links that leave
+ * no node over its degree (Prim's, from node 0), then link every pair
+ * within a radius that gives about GEOMETRIC_DEGREE links a node
+ */
+static void geometric(void)
+{
+    static int inTree[MAX_NODES];
+    static double best[MAX_NODES];
+    static int bestFrom[MAX_NODES];
+    double radius = FIELD * sqrt(GEOMETRIC_DEGREE / (PI * nnodes));
+    int added;
+    int ii, jj;
+
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        nodes[ii].x = FIELD * uniform();
+        nodes[ii].y = FIELD * uniform();
+        inTree[ii] = 0;
+        best[ii] = -1;
+    }
+
+    inTree[0] = 1;
+    for (jj = 1; jj < nnodes; jj++)
+    {
+        best[jj] = distance(0, jj);
+        bestFrom[jj] = 0;
+    }
+    for (added = 1; added < nnodes; added++)
+    {
+        int next = -1;
+
+        for (jj = 0; jj < nnodes; jj++)
+        {
+            if (inTree[jj])
+            {
+                continue;
+            }
+            /* the closest tree node it had is full, find another */
+            if (!hasRoom(bestFrom[jj]))
+            {
+                best[jj] = -1;
+                for (ii = 0; ii < nnodes; ii++)
+                {
+                    if (inTree[ii] && hasRoom(ii) &&
+                        (best[jj] < 0 || distance(ii, jj) < best[jj]))
+                    {
+                        best[jj] = distance(ii, jj);
+                        bestFrom[jj] = ii;
+                    }
+                }
+            }
+            if (best[jj] >= 0 && (next < 0 || best[jj] < best[next]))
+            {
+                next = jj;
+            }
+        }
+        if (next < 0)
+        {
+            fprintf(stderr, "netgen: nodes too full to join up, raise -d\n");
+            exit(1);
+        }
+
+        addLink(bestFrom[next], next);
+        inTree[next] = 1;
+        for (jj = 0; jj < nnodes; jj++)
+        {
+            if (!inTree[jj] && distance(next, jj) < best[jj])
+            {
+                best[jj] = distance(next, jj);
+                bestFrom[jj] = next;
+            }
+        }
+    }
+
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        for (jj = ii + 1; jj < nnodes; jj++)
+        {
+            if (distance(ii, jj) < radius)
+            {
+                addLink(ii, jj);
+            }
+        }
+    }
+}
+
+/*
+ * Barabasi-Albert: each node after the first two links to two earlier
+ * ones, chosen with odds in proportion to their links plus one. nodes
+ * already at the degree cap are left out
+ */
+static void scalefree(void)
+{
+    int ii, jj;
+
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        nodes[ii].x = FIELD * uniform();
+        nodes[ii].y = FIELD * uniform();
+    }
+    if (nnodes > 1)
+    {
+        addLink(0, 1);
+    }
+    for (ii = 2; ii < nnodes; ii++)
+    {
+        int want = ii > 2 ? 2 : 1;
+        int tries;
+
+        for (tries = 0; want > 0 && tries < 1000; tries++)
+        {
+            long total = 0;
+            long point;
+
+            for (jj = 0; jj < ii; jj++)
+            {
+                total += hasRoom(jj) ? nodes[jj].nlinks + 1 : 0;
+            }
+            if (total == 0)
+            {
+                break;
+            }
+            point = (long)(uniform() * total);
+            for (jj = 0; jj < ii; jj++)
+            {
+                point -= hasRoom(jj) ? nodes[jj].nlinks + 1 : 0;
+                if (point < 0)
+                {
+                    break;
+                }
+            }
+            if (jj < ii && addLink(jj, ii))
+            {
+                want--;
+            }
+        }
+        if (nodes[ii].nlinks == 0)
+        {
+            fprintf(stderr, "netgen: nodes too full to join up, raise -d\n");
+            exit(1);
+        }
+    }
+}
+
+static void writeTopology(const char *name)
+{
+    int ii, jj;
+
+    printf("/* Generated by netgen, %d nodes. */\n", nnodes);
+    printf("compile\t\t\t= \"-Itopo/%s assignment.c traffic.c impair.c\",\n", name);
+    printf("maxmessagesize  = 256bytes,\n\n");
+    printf("bandwidth\t\t= 56Kbps,\n\n");
+    printf("messagerate             = 1000ms,\n");
+    printf("propagationdelay        = 2500ms,\n\n");
+    printf("probframecorrupt = 0,\n");
+
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        printf("\nhost n%d {\n", ii);
+        printf("    x=%d, y=%d\n", (int)nodes[ii].x, (int)nodes[ii].y);
+        for (jj = 0; jj < nodes[ii].nlinks; jj++)
+        {
+            int peer = nodes[ii].peers[jj];
+
+            if (peer > ii)
+            {
+                continue;
+            }
+            printf("    link to n%d {\n", peer);
+            printf("        bandwidth = %s\n",
+                    bandwidths[nextRandom() % (sizeof(bandwidths) / sizeof(bandwidths[0]))]);
+            printf("        propagationdelay = %ldms\n",
+                    1 + (long)(distance(ii, peer) / 100));
+            printf("    }\n");
+        }
+        printf("}\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char name[64];
+    const char *title = NULL;
+    const char *kind;
+    int arg = 1;
+
+    while (arg + 1 < argc && argv[arg][0] == '-')
+    {
+        if (strcmp(argv[arg], "-n") == 0)
+        {
+            nnodes = atoi(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "-d") == 0)
+        {
+            maxDegree = atoi(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "-r") == 0)
+        {
+            rng = strtoull(argv[arg + 1], NULL, 0) * 2654435761ULL + 1;
+        }
+        else if (strcmp(argv[arg], "-t") == 0)
+        {
+            title = argv[arg + 1];
+        }
+        else
+        {
+            break;
+        }
+        arg += 2;
+    }
+    if (arg != argc - 1 || nnodes < 2 || nnodes > MAX_NODES ||
+        maxDegree < 2 || maxDegree > MAX_DEGREE)
+    {
+        fprintf(stderr, "usage: netgen [-n nodes] [-d maxdegree] [-r seed] "
+                "[-t name] ring|tree|mesh|geometric|scalefree\n");
+        return 1;
+    }
+    kind = argv[arg];
+
+    if (strcmp(kind, "ring") == 0)
+    {
+        ring();
+    }
+    else if (strcmp(kind, "tree") == 0)
+    {
+        tree();
+    }
+    else if (strcmp(kind, "mesh") == 0)
+    {
+        mesh();
+    }
+    else if (strcmp(kind, "geometric") == 0)
+    {
+        geometric();
+    }
+    else if (strcmp(kind, "scalefree") == 0)
+    {
+        scalefree();
+    }
+    else
+    {
+        fprintf(stderr, "netgen: unknown kind %s\n", kind);
+        return 1;
+    }
+
+    snprintf(name, sizeof(name), "%s-%d", kind, nnodes);
+    writeTopology(title != NULL ? title : name);
+    return 0;
+}
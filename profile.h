@@ -0,0 +1,159 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/*
+ * Counting calls and timing each one for the functions that start with
+ * PROF_FUNC(). Only compiled in with -DPROFILE on the compile line,
+ * without it PROF_FUNC() and prof_report() are nothing at all. Times
+ * are cycles from rdtsc on x86 and nanoseconds from clock_gettime
+ * elsewhere, and include whatever the function calls, so a layer's
+ * time covers the layers above it that it hands the frame to.
+ */
+
+#ifdef PROFILE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* functions that can be profiled, and log2 buckets of call times */
+#define PROF_MAX        48
+#define PROF_BUCKETS    32
+
+typedef struct {
+    const char  *name;
+    int         registered;
+    long        calls;
+    uint64_t    total;
+    uint64_t    max;
+    long        hist[PROF_BUCKETS];     /* calls taking under 2^i */
+} ProfStats;
+
+typedef struct {
+    ProfStats   *stats;
+    uint64_t    start;
+} ProfProbe;
+
+static ProfStats *profList[PROF_MAX];
+static int profCount;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PROF_UNIT "cycles"
+static inline uint64_t prof_now(void)
+{
+    return __rdtsc();
+}
+#else
+#define PROF_UNIT "ns"
+static inline uint64_t prof_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+static inline ProfProbe prof_begin(ProfStats *s, const char *name)
+{
+    ProfProbe p;
+
+    if (!s->registered && profCount < PROF_MAX)
+    {
+        s->name = name;
+        s->registered = 1;
+        profList[profCount++] = s;
+    }
+    p.stats = s;
+    p.start = prof_now();
+    return p;
+}
+
+static inline void prof_end(ProfProbe *p)
+{
+    uint64_t t = prof_now() - p->start;
+    int b = 0;
+
+    while (b < PROF_BUCKETS - 1 && (t >> b) != 0)
+    {
+        b++;
+    }
+    p->stats->calls++;
+    p->stats->total += t;
+    p->stats->hist[b]++;
+    if (t > p->stats->max)
+    {
+        p->stats->max = t;
+    }
+}
+
+/* the time under which pc percent of the calls finished, to the
+ * power of two */
+static inline uint64_t prof_percentile(ProfStats *s, int pc)
+{
+    long want = (s->calls * pc + 99) / 100;
+    long seen = 0;
+    int b;
+
+    for (b = 0; b < PROF_BUCKETS; b++)
+    {
+        seen += s->hist[b];
+        if (seen >= want)
+        {
+            break;
+        }
+    }
+    return (uint64_t)1 << b;
+}
+
+static inline void prof_report(void)
+{
+    ProfStats *s;
+    int ii;
+    int b;
+
+    printf("profile (%s, including what each calls):\n", PROF_UNIT);
+    printf("%-20s %8s %12s %8s %8s %8s %10s\n",
+            "function", "calls", "total", "mean", "p50<", "p99<", "max");
+    for (ii = 0; ii < profCount; ii++)
+    {
+        s = profList[ii];
+        if (s->calls == 0)
+        {
+            continue;
+        }
+        printf("%-20s %8ld %12llu %8llu %8llu %8llu %10llu\n",
+                s->name, s->calls, (unsigned long long)s->total,
+                (unsigned long long)(s->total / s->calls),
+                (unsigned long long)prof_percentile(s, 50),
+                (unsigned long long)prof_percentile(s, 99),
+                (unsigned long long)s->max);
+        printf("%-20s", "");
+        for (b = 0; b < PROF_BUCKETS; b++)
+        {
+            if (s->hist[b] > 0)
+            {
+                printf(" <2^%d:%ld", b, s->hist[b]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+/* times the rest of the function it starts, whichever way it returns */
+#define PROF_FUNC() \
+    static ProfStats prof_stats_; \
+    ProfProbe prof_probe_ __attribute__((cleanup(prof_end))) = \
+        prof_begin(&prof_stats_, __func__)
+
+#else
+
+#define PROF_FUNC()
+#define prof_report()
+
+#endif
+
+#endif
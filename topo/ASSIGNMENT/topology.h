@@ -0,0 +1,117 @@
+/* Generated by topogen from ASSIGNMENT, do not edit. */
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#define NUM_NODES 7
+#define MAX_LINKS 4
+#define MAX_WINDOW 48
+#define MAX_MESSAGE 256
+#define MAX_FRAGMENT 256
+#define MAX_PATHS 1
+#define ACK_EVERY 4
+
+/* a link towards a destination and the cost of the path in usec */
+typedef struct { int link; long cost; } NextHop;
+
+/* every next hop from [node] towards [dest], cheapest first,
+ * unused entries have link 0 */
+static const NextHop nextHops[NUM_NODES][NUM_NODES][MAX_PATHS] = {
+    { /* indonesia */
+        {{0, 0}}, /* indonesia */
+        {{1, 2539428}}, /* malaysia */
+        {{2, 2539428}}, /* singapore */
+        {{3, 2539428}}, /* brunei */
+        {{4, 2539428}}, /* australia */
+        {{4, 5078856}}, /* fiji */
+        {{4, 5078856}}, /* newzealand */
+    },
+    { /* malaysia */
+        {{1, 2539428}}, /* indonesia */
+        {{0, 0}}, /* malaysia */
+        {{2, 2539428}}, /* singapore */
+        {{1, 5078856}}, /* brunei */
+        {{1, 5078856}}, /* australia */
+        {{1, 7618284}}, /* fiji */
+        {{1, 7618284}}, /* newzealand */
+    },
+    { /* singapore */
+        {{1, 2539428}}, /* indonesia */
+        {{2, 2539428}}, /* malaysia */
+        {{0, 0}}, /* singapore */
+        {{1, 5078856}}, /* brunei */
+        {{1, 5078856}}, /* australia */
+        {{1, 7618284}}, /* fiji */
+        {{1, 7618284}}, /* newzealand */
+    },
+    { /* brunei */
+        {{1, 2539428}}, /* indonesia */
+        {{1, 5078856}}, /* malaysia */
+        {{1, 5078856}}, /* singapore */
+        {{0, 0}}, /* brunei */
+        {{1, 5078856}}, /* australia */
+        {{1, 7618284}}, /* fiji */
+        {{1, 7618284}}, /* newzealand */
+    },
+    { /* australia */
+        {{1, 2539428}}, /* indonesia */
+        {{1, 5078856}}, /* malaysia */
+        {{1, 5078856}}, /* singapore */
+        {{1, 5078856}}, /* brunei */
+        {{0, 0}}, /* australia */
+        {{2, 2539428}}, /* fiji */
+        {{3, 2539428}}, /* newzealand */
+    },
+    { /* fiji */
+        {{1, 5078856}}, /* indonesia */
+        {{1, 7618284}}, /* malaysia */
+        {{1, 7618284}}, /* singapore */
+        {{1, 7618284}}, /* brunei */
+        {{1, 2539428}}, /* australia */
+        {{0, 0}}, /* fiji */
+        {{1, 5078856}}, /* newzealand */
+    },
+    { /* newzealand */
+        {{1, 5078856}}, /* indonesia */
+        {{1, 7618284}}, /* malaysia */
+        {{1, 7618284}}, /* singapore */
+        {{1, 7618284}}, /* brunei */
+        {{1, 2539428}}, /* australia */
+        {{1, 5078856}}, /* fiji */
+        {{0, 0}}, /* newzealand */
+    },
+};
+
+/* frames in flight allowed on each link of [node], from link 1 */
+static const int linkWindow[NUM_NODES][MAX_LINKS] = {
+    {48, 48, 48, 48}, /* indonesia */
+    {48, 48, 0, 0}, /* malaysia */
+    {48, 48, 0, 0}, /* singapore */
+    {48, 0, 0, 0}, /* brunei */
+    {48, 48, 48, 0}, /* australia */
+    {48, 0, 0, 0}, /* fiji */
+    {48, 0, 0, 0}, /* newzealand */
+};
+
+/* node at the other end of each link of [node], from link 1 */
+static const int linkPeer[NUM_NODES][MAX_LINKS] = {
+    {1, 2, 3, 4}, /* indonesia */
+    {0, 2, -1, -1}, /* malaysia */
+    {0, 1, -1, -1}, /* singapore */
+    {0, -1, -1, -1}, /* brunei */
+    {0, 5, 6, -1}, /* australia */
+    {4, -1, -1, -1}, /* fiji */
+    {4, -1, -1, -1}, /* newzealand */
+};
+
+/* cost in usec of the cheapest path from [node] to [dest] */
+static const long pathCost[NUM_NODES][NUM_NODES] = {
+    {0, 2539428, 2539428, 2539428, 2539428, 5078856, 5078856}, /* indonesia */
+    {2539428, 0, 2539428, 5078856, 5078856, 7618284, 7618284}, /* malaysia */
+    {2539428, 2539428, 0, 5078856, 5078856, 7618284, 7618284}, /* singapore */
+    {2539428, 5078856, 5078856, 0, 5078856, 7618284, 7618284}, /* brunei */
+    {2539428, 5078856, 5078856, 5078856, 0, 2539428, 2539428}, /* australia */
+    {5078856, 7618284, 7618284, 7618284, 2539428, 0, 5078856}, /* fiji */
+    {5078856, 7618284, 7618284, 7618284, 2539428, 5078856, 0}, /* newzealand */
+};
+
+#endif
@@ -0,0 +1,57 @@
+/* Generated by topogen from TEST, do not edit. */
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#define NUM_NODES 3
+#define MAX_LINKS 2
+#define MAX_WINDOW 48
+#define MAX_MESSAGE 256
+#define MAX_FRAGMENT 256
+#define MAX_PATHS 1
+#define ACK_EVERY 4
+
+/* a link towards a destination and the cost of the path in usec */
+typedef struct { int link; long cost; } NextHop;
+
+/* every next hop from [node] towards [dest], cheapest first,
+ * unused entries have link 0 */
+static const NextHop nextHops[NUM_NODES][NUM_NODES][MAX_PATHS] = {
+    { /* perth */
+        {{0, 0}}, /* perth */
+        {{1, 2539428}}, /* sydney */
+        {{2, 2539428}}, /* melbourne */
+    },
+    { /* sydney */
+        {{1, 2539428}}, /* perth */
+        {{0, 0}}, /* sydney */
+        {{1, 5078856}}, /* melbourne */
+    },
+    { /* melbourne */
+        {{1, 2539428}}, /* perth */
+        {{1, 5078856}}, /* sydney */
+        {{0, 0}}, /* melbourne */
+    },
+};
+
+/* frames in flight allowed on each link of [node], from link 1 */
+static const int linkWindow[NUM_NODES][MAX_LINKS] = {
+    {48, 48}, /* perth */
+    {48, 0}, /* sydney */
+    {48, 0}, /* melbourne */
+};
+
+/* node at the other end of each link of [node], from link 1 */
+static const int linkPeer[NUM_NODES][MAX_LINKS] = {
+    {1, 2}, /* perth */
+    {0, -1}, /* sydney */
+    {0, -1}, /* melbourne */
+};
+
+/* cost in usec of the cheapest path from [node] to [dest] */
+static const long pathCost[NUM_NODES][NUM_NODES] = {
+    {0, 2539428, 2539428}, /* perth */
+    {2539428, 0, 5078856}, /* sydney */
+    {2539428, 5078856, 0}, /* melbourne */
+};
+
+#endif
@@ -0,0 +1,648 @@
+/*
+ * topogen - turn a cnet topology file into topology.h
+ *
+ * Reads the hosts and links of a topology file (ASSIGNMENT, TEST, ...)
+ * and writes a header with the node count, the most links any node has,
+ * every loop free next hop within a slack of the all-pairs shortest
+ * paths for multipath routing, a window size for every link and how
+ * many frames a receiver takes before it ACKs, so the protocol needs no
+ * hand maintained tables.
+ *
+ *     ./topogen [-w maxwindow] [-p maxpaths] [-s slack%] [-f maxfragment]
+ *               TOPOLOGY
+ *
+ * The header is written to stdout, normally to topo/TOPOLOGY/topology.h.
+ *
+ * Nodes are numbered in the order they are first mentioned and links in
+ * the order they are declared, the same way cnet numbers them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_DEGREE      64
+#define MAX_NAME        32
+
+/* roughly the wire header of a data frame, for the estimates */
+#define FRAME_OVERHEAD  20
+
+/* a receiver takes up to this many frames before it ACKs. written into
+ * the header for the protocol, so the windows and it always agree */
+#define ACK_EVERY       4
+
+typedef struct {
+    int     peer;           /* node at the other end */
+    long    bandwidth;      /* bits per second */
+    long    delay;          /* propagation delay in usec */
+} Link;
+
+typedef struct {
+    char    name[MAX_NAME];
+    int     nlinks;
+    Link    links[MAX_DEGREE + 1];  /* links[0] is the loopback */
+} Node;
+
+/* grown as hosts are found, the tables in generate() are sized from
+ * nnodes once they all are */
+static Node *nodes;
+static int nnodes;
+static int maxNodes;
+
+/* topology wide defaults, overridden per link */
+static long bandwidth = 56000;
+static long delay = 2500000;
+static long maxMessage = 256;
+
+/* largest piece of a message one frame carries */
+static long maxFragment = 1024;
+static int maxWindow = 48;
+
+/* next hops kept per destination, and how much dearer than the
+ * shortest path (in percent) an alternative may be */
+static int maxPaths = 4;
+static int slack = 10;
+
+static char *text;
+static char token[256];
+static int line = 1;
+
+static void fail(const char *msg, const char *what)
+{
+    fprintf(stderr, "topogen: line %d: %s %s\n", line, msg, what);
+    exit(1);
+}
+
+/* next word, quoted string or one of { } =, 0 at end of file */
+static int nextToken(void)
+{
+    int n = 0;
+
+    for (;;)
+    {
+        while (*text && (isspace((unsigned char)*text) || *text == ','))
+        {
+            if (*text++ == '\n')
+            {
+                line++;
+            }
+        }
+        if (text[0] == '/' && text[1] == '/')
+        {
+            while (*text && *text != '\n')
+            {
+                text++;
+            }
+        }
+        else if (text[0] == '/' && text[1] == '*')
+        {
+            char *end = strstr(text, "*/");
+            text = end ? end + 2 : text + strlen(text);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (*text == '\0')
+    {
+        return 0;
+    }
+
+    if (*text == '"')
+    {
+        text++;
+        while (*text && *text != '"' && n < (int)sizeof(token) - 1)
+        {
+            token[n++] = *text++;
+        }
+        if (*text == '"')
+        {
+            text++;
+        }
+    }
+    else if (strchr("{}=", *text))
+    {
+        token[n++] = *text++;
+    }
+    else
+    {
+        while (*text && !isspace((unsigned char)*text) &&
+               !strchr("{}=,\"", *text) && n < (int)sizeof(token) - 1)
+        {
+            token[n++] = *text++;
+        }
+    }
+    token[n] = '\0';
+    return 1;
+}
+
+/* "2500ms", "1s", "100usec" in usec */
+static long parseTime(const char *s)
+{
+    char *unit;
+    double value = strtod(s, &unit);
+
+    if (strncmp(unit, "ms", 2) == 0)
+    {
+        return (long)(value * 1000);
+    }
+    if (strncmp(unit, "us", 2) == 0)
+    {
+        return (long)value;
+    }
+    if (unit[0] == 's')
+    {
+        return (long)(value * 1000000);
+    }
+    return (long)value;
+}
+
+/* "56Kbps", "10Mbps" in bits per second */
+static long parseBandwidth(const char *s)
+{
+    char *unit;
+    double value = strtod(s, &unit);
+
+    if (unit[0] == 'K')
+    {
+        value *= 1000;
+    }
+    else if (unit[0] == 'M')
+    {
+        value *= 1000000;
+    }
+    return (long)value;
+}
+
+/* "256bytes", "8KB" in bytes */
+static long parseSize(const char *s)
+{
+    char *unit;
+    long value = strtol(s, &unit, 10);
+
+    if (unit[0] == 'K')
+    {
+        value *= 1024;
+    }
+    else if (unit[0] == 'M')
+    {
+        value *= 1024 * 1024;
+    }
+    return value;
+}
+
+static int findNode(const char *name)
+{
+    int ii;
+
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        if (strcmp(nodes[ii].name, name) == 0)
+        {
+            return ii;
+        }
+    }
+
+    if (nnodes == maxNodes)
+    {
+        maxNodes = maxNodes ? 2 * maxNodes : 64;
+        nodes = realloc(nodes, maxNodes * sizeof(Node));
+        if (nodes == NULL)
+        {
+            fail("out of memory at", name);
+        }
+    }
+    memset(&nodes[nnodes], 0, sizeof(Node));
+    snprintf(nodes[nnodes].name, MAX_NAME, "%.*s", MAX_NAME - 1, name);
+    return nnodes++;
+}
+
+static void addLink(int a, int b, long bw, long pd)
+{
+    int ii;
+
+    /* both ends may declare the same link */
+    for (ii = 1; ii <= nodes[a].nlinks; ii++)
+    {
+        if (nodes[a].links[ii].peer == b)
+        {
+            return;
+        }
+    }
+
+    if (nodes[a].nlinks == MAX_DEGREE || nodes[b].nlinks == MAX_DEGREE)
+    {
+        fail("too many links at", nodes[a].name);
+    }
+
+    Link l = { b, bw, pd };
+    nodes[a].links[++nodes[a].nlinks] = l;
+    l.peer = a;
+    nodes[b].links[++nodes[b].nlinks] = l;
+}
+
+/* key = value, either topology wide or inside a link block */
+static void attribute(const char *key, long *bw, long *pd)
+{
+    if (!nextToken() || strcmp(token, "=") != 0 || !nextToken())
+    {
+        fail("expected = after", key);
+    }
+
+    if (strcmp(key, "bandwidth") == 0)
+    {
+        *bw = parseBandwidth(token);
+    }
+    else if (strcmp(key, "propagationdelay") == 0)
+    {
+        *pd = parseTime(token);
+    }
+    else if (strcmp(key, "maxmessagesize") == 0)
+    {
+        maxMessage = parseSize(token);
+    }
+}
+
+static void parseLink(int host)
+{
+    long bw = bandwidth;
+    long pd = delay;
+    int peer;
+
+    /* link to NAME { ... } */
+    if (!nextToken() || strcmp(token, "to") != 0 || !nextToken())
+    {
+        fail("expected link to", "NAME");
+    }
+    peer = findNode(token);
+
+    if (nextToken() && strcmp(token, "{") == 0)
+    {
+        while (nextToken() && strcmp(token, "}") != 0)
+        {
+            char key[256];
+            strcpy(key, token);
+            attribute(key, &bw, &pd);
+        }
+    }
+    addLink(host, peer, bw, pd);
+}
+
+static void parseHost(void)
+{
+    int host;
+
+    if (!nextToken())
+    {
+        fail("expected host", "NAME");
+    }
+    host = findNode(token);
+
+    if (!nextToken() || strcmp(token, "{") != 0)
+    {
+        fail("expected { after host", nodes[host].name);
+    }
+
+    while (nextToken() && strcmp(token, "}") != 0)
+    {
+        if (strcmp(token, "link") == 0)
+        {
+            parseLink(host);
+        }
+        else
+        {
+            /* x=, winx=, outputfile= and "east of" placement */
+            char *save = text;
+            if (nextToken() && strcmp(token, "=") == 0)
+            {
+                nextToken();
+            }
+            else
+            {
+                text = save;
+            }
+        }
+    }
+}
+
+static void parse(void)
+{
+    while (nextToken())
+    {
+        if (strcmp(token, "host") == 0)
+        {
+            parseHost();
+        }
+        else
+        {
+            char key[256];
+            strcpy(key, token);
+            attribute(key, &bandwidth, &delay);
+        }
+    }
+}
+
+/*
+ * Frames one sender can have outstanding before the first ACK could be
+ * back: the bandwidth-delay product of the link in full frames, and the
+ * frames the receiver may take before it sends that ACK.
+ */
+static int windowFor(const Link *l)
+{
+    long frameTime = (maxFragment + FRAME_OVERHEAD) * 8 * 1000000L / l->bandwidth;
+    long rtt = 2 * (l->delay + frameTime);
+    long window = (rtt + frameTime - 1) / frameTime + ACK_EVERY - 1;
+
+    if (window < 2)
+    {
+        window = 2;
+    }
+    if (window > maxWindow)
+    {
+        window = maxWindow;
+    }
+    return (int)window;
+}
+
+/* cost of sending one full frame over a link */
+static long linkCost(const Link *l)
+{
+    return l->delay + (maxFragment + FRAME_OVERHEAD) * 8 * 1000000L / l->bandwidth;
+}
+
+/*
+ * Fill hops with the links node can use towards dest, cheapest first.
+ * Only neighbours strictly closer to dest are used so that packets
+ * can't loop, however each hop picks among its own alternatives.
+ */
+static int nextHops(long **dist, int node, int dest,
+                    int *hops, long *costs)
+{
+    int n = 0;
+    int ii, jj;
+
+    for (ii = 1; ii <= nodes[node].nlinks; ii++)
+    {
+        Link *l = &nodes[node].links[ii];
+        long cost = linkCost(l) + dist[l->peer][dest];
+
+        if (dist[l->peer][dest] >= dist[node][dest] ||
+            cost * 100 > dist[node][dest] * (100 + slack))
+        {
+            continue;
+        }
+
+        /* insertion sort, ties keep the lower link first */
+        for (jj = n; jj > 0 && costs[jj - 1] > cost; jj--)
+        {
+            hops[jj] = hops[jj - 1];
+            costs[jj] = costs[jj - 1];
+        }
+        hops[jj] = ii;
+        costs[jj] = cost;
+        n++;
+    }
+    return n < maxPaths ? n : maxPaths;
+}
+
+static void generate(const char *file)
+{
+    long **dist = malloc(nnodes * sizeof(*dist));
+    int hops[MAX_DEGREE];
+    long costs[MAX_DEGREE];
+    int ii, jj, kk;
+    int maxLinks = 0;
+    int maxWin = 2;
+    int paths = 1;
+
+    /* grows as the square of the node count */
+    for (ii = 0; dist != NULL && ii < nnodes; ii++)
+    {
+        dist[ii] = malloc(nnodes * sizeof(**dist));
+        if (dist[ii] == NULL)
+        {
+            dist = NULL;
+        }
+    }
+    if (dist == NULL)
+    {
+        fprintf(stderr, "topogen: no memory for the tables of %d nodes\n",
+                nnodes);
+        exit(1);
+    }
+
+    /* Floyd-Warshall */
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        for (jj = 0; jj < nnodes; jj++)
+        {
+            dist[ii][jj] = ii == jj ? 0 : -1;
+        }
+        for (jj = 1; jj <= nodes[ii].nlinks; jj++)
+        {
+            Link *l = &nodes[ii].links[jj];
+            if (dist[ii][l->peer] < 0 || linkCost(l) < dist[ii][l->peer])
+            {
+                dist[ii][l->peer] = linkCost(l);
+            }
+        }
+        if (nodes[ii].nlinks > maxLinks)
+        {
+            maxLinks = nodes[ii].nlinks;
+        }
+    }
+
+    for (kk = 0; kk < nnodes; kk++)
+    {
+        for (ii = 0; ii < nnodes; ii++)
+        {
+            if (dist[ii][kk] < 0)
+            {
+                continue;
+            }
+            for (jj = 0; jj < nnodes; jj++)
+            {
+                if (dist[kk][jj] < 0)
+                {
+                    continue;
+                }
+                if (dist[ii][jj] < 0 || dist[ii][kk] + dist[kk][jj] < dist[ii][jj])
+                {
+                    dist[ii][jj] = dist[ii][kk] + dist[kk][jj];
+                }
+            }
+        }
+    }
+
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        for (jj = 0; jj < nnodes; jj++)
+        {
+            if (dist[ii][jj] < 0)
+            {
+                fprintf(stderr, "topogen: %s can't reach %s\n",
+                        nodes[ii].name, nodes[jj].name);
+                exit(1);
+            }
+        }
+        for (jj = 1; jj <= nodes[ii].nlinks; jj++)
+        {
+            if (windowFor(&nodes[ii].links[jj]) > maxWin)
+            {
+                maxWin = windowFor(&nodes[ii].links[jj]);
+            }
+        }
+        for (jj = 0; jj < nnodes; jj++)
+        {
+            if (jj != ii && nextHops(dist, ii, jj, hops, costs) > paths)
+            {
+                paths = nextHops(dist, ii, jj, hops, costs);
+            }
+        }
+    }
+
+    printf("/* Generated by topogen from %s, do not edit. */\n", file);
+    printf("#ifndef TOPOLOGY_H\n#define TOPOLOGY_H\n\n");
+    printf("#define NUM_NODES %d\n", nnodes);
+    printf("#define MAX_LINKS %d\n", maxLinks);
+    printf("#define MAX_WINDOW %d\n", maxWin);
+    printf("#define MAX_MESSAGE %ld\n", maxMessage);
+    printf("#define MAX_FRAGMENT %ld\n", maxFragment);
+    printf("#define MAX_PATHS %d\n", paths);
+    printf("#define ACK_EVERY %d\n\n", ACK_EVERY);
+
+    printf("/* a link towards a destination and the cost of the path in usec */\n");
+    printf("typedef struct { int link; long cost; } NextHop;\n\n");
+    printf("/* every next hop from [node] towards [dest], cheapest first,\n");
+    printf(" * unused entries have link 0 */\n");
+    printf("static const NextHop nextHops[NUM_NODES][NUM_NODES][MAX_PATHS] = {\n");
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        printf("    { /* %s */\n", nodes[ii].name);
+        for (jj = 0; jj < nnodes; jj++)
+        {
+            int n = jj == ii ? 0 : nextHops(dist, ii, jj, hops, costs);
+
+            printf("        {");
+            for (kk = 0; kk < paths; kk++)
+            {
+                printf("%s{%d, %ld}", kk ? ", " : "",
+                        kk < n ? hops[kk] : 0, kk < n ? costs[kk] : 0L);
+            }
+            printf("}, /* %s */\n", nodes[jj].name);
+        }
+        printf("    },\n");
+    }
+    printf("};\n\n");
+
+    printf("/* frames in flight allowed on each link of [node], from link 1 */\n");
+    printf("static const int linkWindow[NUM_NODES][MAX_LINKS] = {\n");
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        printf("    {");
+        for (jj = 1; jj <= maxLinks; jj++)
+        {
+            int window = jj <= nodes[ii].nlinks ? windowFor(&nodes[ii].links[jj]) : 0;
+            printf("%s%d", jj > 1 ? ", " : "", window);
+        }
+        printf("}, /* %s */\n", nodes[ii].name);
+    }
+    printf("};\n\n");
+
+    printf("/* node at the other end of each link of [node], from link 1 */\n");
+    printf("static const int linkPeer[NUM_NODES][MAX_LINKS] = {\n");
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        printf("    {");
+        for (jj = 1; jj <= maxLinks; jj++)
+        {
+            int peer = jj <= nodes[ii].nlinks ? nodes[ii].links[jj].peer : -1;
+            printf("%s%d", jj > 1 ? ", " : "", peer);
+        }
+        printf("}, /* %s */\n", nodes[ii].name);
+    }
+    printf("};\n\n");
+
+    printf("/* cost in usec of the cheapest path from [node] to [dest] */\n");
+    printf("static const long pathCost[NUM_NODES][NUM_NODES] = {\n");
+    for (ii = 0; ii < nnodes; ii++)
+    {
+        printf("    {");
+        for (jj = 0; jj < nnodes; jj++)
+        {
+            printf("%s%ld", jj ? ", " : "", dist[ii][jj]);
+        }
+        printf("}, /* %s */\n", nodes[ii].name);
+    }
+    printf("};\n\n#endif\n");
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+    long size;
+    int arg = 1;
+
+    while (arg + 1 < argc && argv[arg][0] == '-')
+    {
+        if (strcmp(argv[arg], "-w") == 0)
+        {
+            maxWindow = atoi(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "-p") == 0)
+        {
+            maxPaths = atoi(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "-s") == 0)
+        {
+            slack = atoi(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "-f") == 0)
+        {
+            maxFragment = atol(argv[arg + 1]);
+        }
+        else
+        {
+            break;
+        }
+        arg += 2;
+    }
+    if (arg != argc - 1 || maxPaths < 1 || maxPaths > MAX_DEGREE)
+    {
+        fprintf(stderr, "usage: topogen [-w maxwindow] [-p maxpaths] "
+                "[-s slack%%] [-f maxfragment] TOPOLOGY\n");
+        return 1;
+    }
+
+    fp = fopen(argv[arg], "r");
+    if (fp == NULL)
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    text = calloc(size + 1, 1);
+    if (fread(text, 1, size, fp) != (size_t)size)
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+    fclose(fp);
+
+    parse();
+    if (maxFragment > maxMessage)
+    {
+        maxFragment = maxMessage;
+    }
+    if (nnodes == 0)
+    {
+        fprintf(stderr, "topogen: no hosts in %s\n", argv[arg]);
+        return 1;
+    }
+    generate(argv[arg]);
+    return 0;
+}
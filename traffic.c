@@ -0,0 +1,640 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <cnet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "traffic.h"
+
+/*
+ * Reproducible application traffic. Either a recorded trace is streamed
+ * back record by record, or one of the synthetic generators produces
+ * records from a seeded per-node random number generator. Both give the
+ * same workload on every run so protocol versions can be compared.
+ */
+
+static TrafficMode mode = TRAFFIC_CNET;
+static int numNodes;
+static size_t maxSize;
+
+/* generator parameters, all times in usec */
+static CnetTime meanGap = 1000000;
+static CnetTime meanOn = 2000000;
+static CnetTime meanOff = 8000000;
+static size_t minSize = 1;
+static size_t fixedSize = 0;
+static int numFlows = 1;
+static int groupSize = 1;
+static int hotspot = -1;
+static int hotPercent = 0;
+static unsigned long long rng;
+
+/* generator state */
+static CnetTime genClock;
+static CnetTime burstEnd;
+
+/* replay source, memory mapped when possible and streamed otherwise */
+static const char *map;
+static size_t mapLen;
+static size_t mapPos;
+static FILE *stream;
+
+/* optional trace of what was generated, for replaying later */
+static FILE *recordFile;
+
+/* sender and receiver statistics, sequence numbers are per destination
+ * and flow, indexed by node * numFlows + flow */
+static int *nextSeq;
+static int *expectedSeq;
+static long sent, sentBytes;
+static long delivered, deliveredBytes, outOfOrder, multicasts;
+static CnetTime latencyTotal, latencyMax;
+
+/* latencies counted in eight steps per power of two of usec, enough
+ * to tell percentiles apart to within an eighth */
+#define LATENCY_STEPS   8
+#define LATENCY_BUCKETS (64 * LATENCY_STEPS)
+static long latencyCount[LATENCY_BUCKETS];
+
+static int latencyBucket(CnetTime latency)
+{
+    int top = 0;
+
+    if (latency < LATENCY_STEPS)
+    {
+        return latency < 0 ? 0 : (int)latency;
+    }
+    while ((latency >> top) >= 2 * LATENCY_STEPS)
+    {
+        top++;
+    }
+    return top * LATENCY_STEPS + (int)(latency >> top);
+}
+
+/* the latency under which pc percent of deliveries arrived, to the
+ * top of its bucket */
+static CnetTime latencyPercentile(int pc)
+{
+    long want = (delivered * pc + 99) / 100;
+    long seen = 0;
+    int b;
+
+    for (b = 0; b < LATENCY_BUCKETS - 1; b++)
+    {
+        seen += latencyCount[b];
+        if (seen >= want)
+        {
+            break;
+        }
+    }
+    if (b < LATENCY_STEPS)
+    {
+        return b + 1;
+    }
+    return (CnetTime)(b % LATENCY_STEPS + LATENCY_STEPS + 1) <<
+        (b / LATENCY_STEPS - 1);
+}
+
+/* xorshift64*, the generators keep their state in rng so each node
+ * has its own stream */
+unsigned long long traffic_random(unsigned long long *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+double traffic_uniform(unsigned long long *state)
+{
+    return (traffic_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static CnetTime exponential(CnetTime mean)
+{
+    return (CnetTime)(-log(1.0 - traffic_uniform(&rng)) * mean) + 1;
+}
+
+CnetTime traffic_time(const char *s)
+{
+    char *unit;
+    double value = strtod(s, &unit);
+
+    if (strncmp(unit, "ms", 2) == 0)
+    {
+        return (CnetTime)(value * 1000);
+    }
+    if (strncmp(unit, "us", 2) == 0)
+    {
+        return (CnetTime)value;
+    }
+    if (unit[0] == 's')
+    {
+        return (CnetTime)(value * 1000000);
+    }
+    return (CnetTime)value;
+}
+
+/* "256", "256bytes" or "64KB" */
+static size_t parseSize(const char *s)
+{
+    char *unit;
+    size_t value = strtoul(s, &unit, 10);
+
+    if (strncmp(unit, "KB", 2) == 0)
+    {
+        value *= 1024;
+    }
+    return value;
+}
+
+static int openTrace(const char *file)
+{
+    int fd = open(file, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0)
+    {
+        printf("TRAFFIC: cannot open trace %s\n", file);
+        return -1;
+    }
+
+    /* every node opens the trace for itself and reads it all, picking
+     * out its own records. a pipe would be shared between the nodes in
+     * one cnet process, each taking lines the others need */
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        printf("TRAFFIC: trace %s is not a regular file\n", file);
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size > 0)
+    {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            map = p;
+            mapLen = st.st_size;
+            mapPos = 0;
+            close(fd);
+            return 0;
+        }
+    }
+
+    /* a file that can't be mapped is read a line at a time */
+    stream = fdopen(fd, "r");
+    return stream == NULL ? -1 : 0;
+}
+
+/* copy the next line of the trace into buf, 0 at end of trace */
+static int readLine(char *buf, size_t size)
+{
+    size_t n = 0;
+
+    if (stream != NULL)
+    {
+        if (fgets(buf, size, stream) == NULL)
+        {
+            return 0;
+        }
+        buf[strcspn(buf, "\n")] = '\0';
+        return 1;
+    }
+
+    if (map == NULL || mapPos >= mapLen)
+    {
+        return 0;
+    }
+
+    while (mapPos < mapLen && map[mapPos] != '\n')
+    {
+        if (n < size - 1)
+        {
+            buf[n++] = map[mapPos];
+        }
+        mapPos++;
+    }
+    mapPos++;
+    buf[n] = '\0';
+    return 1;
+}
+
+/* read a dest field, one node or a multicast group as "2+4+5" */
+static int parseGroup(const char *s, TrafficRecord *r)
+{
+    char *end;
+
+    r->group = 0;
+    while (r->group < TRAFFIC_GROUP_MAX)
+    {
+        r->members[r->group++] = strtol(s, &end, 10);
+        if (end == s)
+        {
+            return 0;
+        }
+        if (*end != '+')
+        {
+            break;
+        }
+        s = end + 1;
+    }
+    r->dest = r->members[0];
+    return 1;
+}
+
+/* the flow count a recorded trace was made with, from its "# flows N"
+ * header, leaving the position at the first record. 0 if it has none */
+static int traceFlows(void)
+{
+    char line[128];
+    size_t pos;
+    long spos;
+    int flows = 0, n;
+
+    for (;;)
+    {
+        pos = mapPos;
+        spos = stream != NULL ? ftell(stream) : 0;
+        if (!readLine(line, sizeof(line)))
+        {
+            break;
+        }
+        if (line[0] != '#')
+        {
+            mapPos = pos;
+            if (stream != NULL)
+            {
+                fseek(stream, spos, SEEK_SET);
+            }
+            break;
+        }
+        if (sscanf(line, "# flows %d", &n) == 1 && n > flows)
+        {
+            flows = n;
+        }
+    }
+    return flows;
+}
+
+static int nextReplay(TrafficRecord *r)
+{
+    char line[128];
+    char dest[64];
+    long long time;
+    int src, flow, ii;
+    unsigned long size;
+
+    while (readLine(line, sizeof(line)))
+    {
+        flow = 0;
+        if (line[0] == '#' || sscanf(line, "%lld %d %63s %lu %d",
+                    &time, &src, dest, &size, &flow) < 4)
+        {
+            continue;
+        }
+        if (src != nodeinfo.nodenumber || !parseGroup(dest, r))
+        {
+            continue;
+        }
+
+        for (ii = 0; ii < r->group; ii++)
+        {
+            if (r->members[ii] < 0 || r->members[ii] >= numNodes ||
+                r->members[ii] == nodeinfo.nodenumber)
+            {
+                break;
+            }
+        }
+        if (ii < r->group || flow < 0 || flow >= numFlows)
+        {
+            printf("TRAFFIC: bad dest or flow in trace, %s\n", line);
+            continue;
+        }
+
+        r->time = time;
+        r->src = src;
+        r->size = size;
+        r->flow = flow;
+        return 1;
+    }
+    return 0;
+}
+
+/* pick the rest of a multicast group, anyone not already in it */
+static void pickGroup(TrafficRecord *r)
+{
+    CnetAddr dest;
+    int want = groupSize < numNodes - 1 ? groupSize : numNodes - 1;
+    int ii;
+
+    if (want > TRAFFIC_GROUP_MAX)
+    {
+        want = TRAFFIC_GROUP_MAX;
+    }
+    r->group = 1;
+    r->members[0] = r->dest;
+    while (r->group < want)
+    {
+        dest = traffic_random(&rng) % numNodes;
+        for (ii = 0; ii < r->group && r->members[ii] != dest; ii++)
+        {
+        }
+        if (dest != nodeinfo.nodenumber && ii == r->group)
+        {
+            r->members[r->group++] = dest;
+        }
+    }
+}
+
+static int nextSynthetic(TrafficRecord *r)
+{
+    if (numNodes < 2)
+    {
+        return 0;
+    }
+
+    genClock += exponential(meanGap);
+
+    /* skip over the silent part of each on/off cycle */
+    if (mode == TRAFFIC_ONOFF && genClock > burstEnd)
+    {
+        genClock = burstEnd + exponential(meanOff);
+        burstEnd = genClock + exponential(meanOn);
+    }
+
+    r->time = genClock;
+    r->src = nodeinfo.nodenumber;
+
+    if (hotspot >= 0 && hotspot != nodeinfo.nodenumber &&
+        (int)(traffic_random(&rng) % 100) < hotPercent)
+    {
+        r->dest = hotspot;
+    }
+    else
+    {
+        /* anyone but ourselves */
+        r->dest = traffic_random(&rng) % (numNodes - 1);
+        if (r->dest >= nodeinfo.nodenumber)
+        {
+            r->dest++;
+        }
+    }
+
+    if (fixedSize != 0)
+    {
+        r->size = fixedSize;
+    }
+    else
+    {
+        r->size = minSize + traffic_random(&rng) % (maxSize - minSize + 1);
+    }
+    r->flow = traffic_random(&rng) % numFlows;
+    pickGroup(r);
+    return 1;
+}
+
+/**
+ * Read the TRAFFIC environment variable and set up the chosen source.
+ * Returns TRAFFIC_CNET when the cnet application layer should be used.
+ */
+TrafficMode traffic_init(int nnodes, size_t maxsize)
+{
+    const char *env = getenv("TRAFFIC");
+    char spec[512];
+    char *word;
+    const char *file = NULL;
+    unsigned long long seed = 1;
+
+    numNodes = nnodes;
+    maxSize = maxsize;
+    mode = TRAFFIC_CNET;
+
+    if (env == NULL || env[0] == '\0')
+    {
+        return mode;
+    }
+    numFlows = 0;
+
+    strncpy(spec, env, sizeof(spec) - 1);
+    spec[sizeof(spec) - 1] = '\0';
+
+    for (word = strtok(spec, " ,"); word != NULL; word = strtok(NULL, " ,"))
+    {
+        char *value = strchr(word, '=');
+
+        if (value == NULL)
+        {
+            if (strcmp(word, "replay") == 0)       mode = TRAFFIC_REPLAY;
+            else if (strcmp(word, "poisson") == 0) mode = TRAFFIC_POISSON;
+            else if (strcmp(word, "onoff") == 0)   mode = TRAFFIC_ONOFF;
+            else if (strcmp(word, "hotspot") == 0) mode = TRAFFIC_HOTSPOT;
+            else printf("TRAFFIC: unknown mode %s\n", word);
+            continue;
+        }
+
+        *value++ = '\0';
+        if (strcmp(word, "file") == 0)             file = value;
+        else if (strcmp(word, "seed") == 0)        seed = strtoull(value, NULL, 10);
+        else if (strcmp(word, "rate") == 0)        meanGap = traffic_time(value);
+        else if (strcmp(word, "on") == 0)          meanOn = traffic_time(value);
+        else if (strcmp(word, "off") == 0)         meanOff = traffic_time(value);
+        else if (strcmp(word, "size") == 0)        fixedSize = parseSize(value);
+        else if (strcmp(word, "minsize") == 0)     minSize = parseSize(value);
+        else if (strcmp(word, "hotspot") == 0)     hotspot = atoi(value);
+        else if (strcmp(word, "hot") == 0)         hotPercent = atoi(value);
+        else if (strcmp(word, "flows") == 0)       numFlows = atoi(value);
+        else if (strcmp(word, "group") == 0)       groupSize = atoi(value);
+        else if (strcmp(word, "record") == 0)      recordFile = fopen(value, "a");
+        else printf("TRAFFIC: unknown option %s\n", word);
+    }
+
+    if (fixedSize > maxSize)
+    {
+        fixedSize = maxSize;
+    }
+    if (minSize < 1 || minSize > maxSize)
+    {
+        minSize = 1;
+    }
+    if (mode == TRAFFIC_HOTSPOT && hotspot < 0)
+    {
+        hotspot = 0;
+        hotPercent = hotPercent == 0 ? 50 : hotPercent;
+    }
+
+    /* every node gets its own, but repeatable, random stream */
+    rng = seed * 0x9E3779B97F4A7C15ULL + nodeinfo.nodenumber + 1;
+    genClock = nodeinfo.time_in_usec;
+    burstEnd = genClock + exponential(meanOn);
+
+    if (mode == TRAFFIC_REPLAY && (file == NULL || openTrace(file) != 0))
+    {
+        printf("TRAFFIC: replay needs a regular file=, using cnet\n");
+        mode = TRAFFIC_CNET;
+    }
+
+    /* a recorded trace says how many flows it used, unless flows= is
+     * given too. a flow outside them is rejected, not folded onto another */
+    if (mode == TRAFFIC_REPLAY && numFlows < 1)
+    {
+        numFlows = traceFlows();
+    }
+    if (numFlows < 1)
+    {
+        numFlows = 1;
+    }
+    if (recordFile != NULL)
+    {
+        fprintf(recordFile, "# flows %d\n", numFlows);
+        fflush(recordFile);
+    }
+
+    nextSeq = calloc(numNodes * numFlows, sizeof(int));
+    expectedSeq = calloc(numNodes * numFlows, sizeof(int));
+    printf("TRAFFIC: mode %d seed %llu\n", mode, seed);
+    return mode;
+}
+
+/**
+ * Fetch the next message this node should send. Returns 0 once a replayed
+ * trace has no more records for us.
+ */
+int traffic_next(TrafficRecord *r)
+{
+    int found;
+
+    if (mode == TRAFFIC_REPLAY)
+    {
+        found = nextReplay(r);
+    }
+    else
+    {
+        found = nextSynthetic(r);
+    }
+
+    if (found && r->size > maxSize)
+    {
+        r->size = maxSize;
+    }
+
+    /* every message carries its stamp */
+    if (found && r->size < sizeof(TrafficStamp))
+    {
+        r->size = sizeof(TrafficStamp);
+    }
+
+    if (found && recordFile != NULL)
+    {
+        int ii;
+
+        fprintf(recordFile, "%lld %d %d", (long long)r->time, r->src, r->dest);
+        for (ii = 1; ii < r->group; ii++)
+        {
+            fprintf(recordFile, "+%d", r->members[ii]);
+        }
+        fprintf(recordFile, " %lu %d\n", (unsigned long)r->size, r->flow);
+        fflush(recordFile);
+    }
+    return found;
+}
+
+/**
+ * Build the payload for a record. The contents only depend on the record
+ * and how many messages we have already sent, never on timing.
+ */
+void traffic_fill(const TrafficRecord *r, char *data)
+{
+    TrafficStamp stamp;
+    size_t ii;
+
+    stamp.src = nodeinfo.nodenumber;
+    stamp.flow = r->flow;
+    stamp.seq = r->group > 1 ? -1 : nextSeq[r->dest * numFlows + r->flow]++;
+    stamp.sent = nodeinfo.time_in_usec;
+
+    for (ii = 0; ii < r->size; ii++)
+    {
+        data[ii] = (char)(stamp.seq * 31 + ii);
+    }
+    memcpy(data, &stamp, sizeof(TrafficStamp));
+
+    sent++;
+    sentBytes += r->size;
+}
+
+/**
+ * Account for a message that reached its destination, used in place of
+ * CNET_write_application() for generated traffic.
+ */
+void traffic_deliver(const char *data, size_t len)
+{
+    TrafficStamp stamp;
+    int *expected;
+
+    delivered++;
+    deliveredBytes += len;
+
+    if (len < sizeof(TrafficStamp))
+    {
+        return;
+    }
+
+    memcpy(&stamp, data, sizeof(TrafficStamp));
+    if (stamp.src < 0 || stamp.src >= numNodes ||
+        stamp.flow < 0 || stamp.flow >= numFlows)
+    {
+        return;
+    }
+
+    /* multicasts aren't kept in order, they only have a latency */
+    if (stamp.seq < 0)
+    {
+        multicasts++;
+    }
+    else
+    {
+        expected = &expectedSeq[stamp.src * numFlows + stamp.flow];
+        if (stamp.seq != *expected)
+        {
+            printf("TRAFFIC: from %d flow %d got seq %d want %d\n",
+                    stamp.src, stamp.flow, stamp.seq, *expected);
+            outOfOrder++;
+        }
+        if (stamp.seq >= *expected)
+        {
+            *expected = stamp.seq + 1;
+        }
+    }
+
+    CnetTime latency = nodeinfo.time_in_usec - stamp.sent;
+    latencyTotal += latency;
+    if (latency > latencyMax)
+    {
+        latencyMax = latency;
+    }
+    latencyCount[latencyBucket(latency)]++;
+}
+
+void traffic_report(void)
+{
+    if (mode == TRAFFIC_CNET)
+    {
+        return;
+    }
+
+    printf("TRAFFIC: sent %ld msgs %ld bytes\n", sent, sentBytes);
+    printf("TRAFFIC: delivered %ld msgs %ld bytes, %ld out of order, "
+            "%ld multicast\n", delivered, deliveredBytes, outOfOrder, multicasts);
+    if (delivered > 0)
+    {
+        printf("TRAFFIC: latency avg %lldusec max %lldusec p50 %lldusec "
+                "p99 %lldusec\n",
+                (long long)(latencyTotal / delivered), (long long)latencyMax,
+                (long long)latencyPercentile(50), (long long)latencyPercentile(99));
+    }
+}
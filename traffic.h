@@ -0,0 +1,62 @@
+#ifndef TRAFFIC_H
+#define TRAFFIC_H
+
+#include <cnet.h>
+
+/*
+ * Where application messages come from. TRAFFIC_CNET is the default and
+ * uses CNET_read_application(), every other mode is driven by the
+ * TRAFFIC environment variable, e.g.
+ *
+ *     TRAFFIC="replay file=workload.trace"
+ *     TRAFFIC="poisson rate=500ms size=256 seed=7"
+ *     TRAFFIC="onoff rate=50ms on=2s off=8s"
+ *     TRAFFIC="hotspot rate=1s hotspot=1 hot=80 record=workload.trace"
+ *     TRAFFIC="poisson rate=200ms flows=8"
+ *     TRAFFIC="poisson rate=2s group=4"
+ */
+typedef enum { TRAFFIC_CNET, TRAFFIC_REPLAY, TRAFFIC_POISSON,
+               TRAFFIC_ONOFF, TRAFFIC_HOTSPOT } TrafficMode;
+
+/* the most destinations one message can be multicast to */
+#define TRAFFIC_GROUP_MAX 16
+
+/* one message of the workload. trace files hold one per line as
+ * "time src dest size [flow]" with time in usec since the simulation
+ * started, a multicast's dest is its group as "2+4+5". messages are
+ * only kept in order within a flow, multicasts aren't kept in order */
+typedef struct {
+    CnetTime    time;
+    CnetAddr    src;
+    CnetAddr    dest;       /* the first of the group for a multicast */
+    size_t      size;
+    int         flow;
+    int         group;      /* destinations, more than one to multicast */
+    CnetAddr    members[TRAFFIC_GROUP_MAX];
+} TrafficRecord;
+
+/* stamped onto the front of every generated message so the destination
+ * can check ordering and measure delivery latency. multicasts have a
+ * seq of -1 */
+typedef struct {
+    CnetAddr    src;
+    int         flow;
+    int         seq;
+    CnetTime    sent;
+} TrafficStamp;
+
+TrafficMode traffic_init(int nnodes, size_t maxsize);
+int traffic_next(TrafficRecord *r);
+void traffic_fill(const TrafficRecord *r, char *data);
+void traffic_deliver(const char *data, size_t len);
+void traffic_report(void);
+
+/* xorshift64* over the caller's state, and the same as uniform in
+ * [0, 1), for anything else that wants a reproducible stream */
+unsigned long long traffic_random(unsigned long long *state);
+double traffic_uniform(unsigned long long *state);
+
+/* "500ms", "2s", "1500usec" or a bare number of usec */
+CnetTime traffic_time(const char *s);
+
+#endif
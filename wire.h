@@ -0,0 +1,144 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Reading and writing frame headers a byte at a time, so that hosts
+ * with different byte orders and int sizes read what each other
+ * wrote. Fixed size numbers go most significant byte first, varints
+ * seven bits to a byte, low bits first, with the top bit set on every
+ * byte but the last.
+ */
+
+/* the most bytes a 32 bit varint can take */
+#define WIRE_VARMAX 5
+
+typedef struct {
+    unsigned char   *buf;
+    size_t          len;    /* bytes that can be read or written */
+    size_t          pos;
+    int             bad;    /* ran off the end or read a bad varint */
+} Wire;
+
+static inline void wire_init(Wire *w, unsigned char *buf, size_t len)
+{
+    w->buf = buf;
+    w->len = len;
+    w->pos = 0;
+    w->bad = 0;
+}
+
+/* bytes a varint of v takes */
+static inline size_t wire_varlen(uint32_t v)
+{
+    size_t n = 1;
+
+    while (v >= 0x80)
+    {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static inline void wire_put8(Wire *w, uint32_t v)
+{
+    if (w->pos + 1 > w->len)
+    {
+        w->bad = 1;
+        return;
+    }
+    w->buf[w->pos++] = v & 0xff;
+}
+
+static inline void wire_put16(Wire *w, uint32_t v)
+{
+    wire_put8(w, v >> 8);
+    wire_put8(w, v);
+}
+
+static inline void wire_put32(Wire *w, uint32_t v)
+{
+    wire_put16(w, v >> 16);
+    wire_put16(w, v);
+}
+
+static inline void wire_putvar(Wire *w, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        wire_put8(w, (v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    wire_put8(w, v);
+}
+
+static inline void wire_putbytes(Wire *w, const void *data, size_t len)
+{
+    if (w->pos + len > w->len)
+    {
+        w->bad = 1;
+        return;
+    }
+    memcpy(w->buf + w->pos, data, len);
+    w->pos += len;
+}
+
+static inline uint32_t wire_get8(Wire *w)
+{
+    if (w->pos + 1 > w->len)
+    {
+        w->bad = 1;
+        return 0;
+    }
+    return w->buf[w->pos++];
+}
+
+static inline uint32_t wire_get16(Wire *w)
+{
+    uint32_t v = wire_get8(w) << 8;
+
+    return v | wire_get8(w);
+}
+
+static inline uint32_t wire_get32(Wire *w)
+{
+    uint32_t v = wire_get16(w) << 16;
+
+    return v | wire_get16(w);
+}
+
+static inline uint32_t wire_getvar(Wire *w)
+{
+    uint32_t v = 0;
+    uint32_t b;
+    int shift;
+
+    for (shift = 0; shift < 7 * WIRE_VARMAX; shift += 7)
+    {
+        b = wire_get8(w);
+        v |= (b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            return v;
+        }
+    }
+    w->bad = 1;
+    return 0;
+}
+
+static inline void wire_getbytes(Wire *w, void *data, size_t len)
+{
+    if (w->pos + len > w->len)
+    {
+        w->bad = 1;
+        return;
+    }
+    memcpy(data, w->buf + w->pos, len);
+    w->pos += len;
+}
+
+#endif